@@ -1,5 +1,6 @@
 #include <iostream>
 #include <unistd.h>
+#include <string.h>
 #include "src/rbfcore.h"
 #include "src/readers.h"
 using namespace std;
@@ -19,14 +20,43 @@ int main(int argc, char** argv)
     string outpath, pcname, ext, inpath;
 
     int n_voxel_line = 100;
+    vector<int> n_voxel_levels;
 
     double user_lambda = 0;
 
     bool issurfacing = false;
 
+    bool ismemorylean = false;
+
+    bool isconcurrentsearch = false;
+
+    bool ismixedprecision = false;
+
+    double support_ratio = -1;
+
+    double treecode_theta = 0;
+
+    double surf_tolerance = 0;
+
+    bool isnarrowband = false;
+
+    double adaptive_error = 0;
+
+    int ply_format = PLY_ASCII;
+
+    bool isstreamsurface = false;
+
+    bool issavemodel = false;
+
+    string queryfilename;
+
+    string kcache_dir;
+
+    bool isshiftinvert = false;
+
     int c;
     optind=1;
-    while ((c = getopt(argc, argv, "i:o:l:s:")) != -1) {
+    while ((c = getopt(argc, argv, "i:o:l:s:Mcfr:t:e:ba:p:wmq:k:x")) != -1) {
         switch (c) {
         case 'i':
             infilename = optarg;
@@ -39,7 +69,54 @@ int main(int argc, char** argv)
             break;
         case 's':
             issurfacing = true;
-            n_voxel_line = atoi(optarg);
+            /* 50,100,200: coarse to fine */
+            for(char *p = strtok(optarg, ","); p != NULL; p = strtok(NULL, ","))n_voxel_levels.push_back(atoi(p));
+            if(!n_voxel_levels.empty())n_voxel_line = n_voxel_levels.back();
+            break;
+        case 'M':
+            ismemorylean = true;
+            break;
+        case 'c':
+            isconcurrentsearch = true;
+            break;
+        case 'f':
+            ismixedprecision = true;
+            break;
+        case 'r':
+            support_ratio = atof(optarg);
+            break;
+        case 't':
+            treecode_theta = atof(optarg);
+            break;
+        case 'e':
+            surf_tolerance = atof(optarg);
+            break;
+        case 'b':
+            isnarrowband = true;
+            break;
+        case 'a':
+            adaptive_error = atof(optarg);
+            break;
+        case 'p':
+            if(string(optarg)=="ascii")ply_format = PLY_ASCII;
+            else if(string(optarg)=="float")ply_format = PLY_BINARY_FLOAT;
+            else if(string(optarg)=="double")ply_format = PLY_BINARY_DOUBLE;
+            else cout << "Bad PLY format " << optarg << ", ascii used" << endl;
+            break;
+        case 'w':
+            isstreamsurface = true;
+            break;
+        case 'm':
+            issavemodel = true;
+            break;
+        case 'q':
+            queryfilename = optarg;
+            break;
+        case 'k':
+            kcache_dir = optarg;
+            break;
+        case 'x':
+            isshiftinvert = true;
             break;
         case '?':
             cout << "Bad argument setting!" << endl;
@@ -56,26 +133,80 @@ int main(int argc, char** argv)
     cout<<"is surfacing: "<<issurfacing<<endl;
 
     cout<<"number of voxel per D: "<<n_voxel_line<<endl;
+    if(n_voxel_levels.size()>1){
+        cout<<"progressive surfacing:";
+        for(int n:n_voxel_levels)cout<<" "<<n;
+        cout<<endl;
+    }
+    cout<<"memory lean: "<<ismemorylean<<endl;
+    cout<<"concurrent lambda search: "<<isconcurrentsearch<<endl;
+    cout<<"mixed precision: "<<ismixedprecision<<endl;
+    if(support_ratio>0)cout<<"compact kernel support: "<<support_ratio<<endl;
+    if(treecode_theta>0)cout<<"tree-code theta: "<<treecode_theta<<endl;
+    if(surf_tolerance>0)cout<<"surface vertex tolerance: "<<surf_tolerance<<endl;
+    if(isnarrowband)cout<<"narrow band surfacing: "<<isnarrowband<<endl;
+    if(adaptive_error>0)cout<<"adaptive surfacing error: "<<adaptive_error<<endl;
+    if(isstreamsurface)cout<<"streamed surface output: "<<isstreamsurface<<endl;
+    if(ply_format!=PLY_ASCII)cout<<"binary PLY output: "<<(ply_format==PLY_BINARY_DOUBLE ? "double" : "float")<<endl;
+    if(issavemodel)cout<<"save model: "<<issavemodel<<endl;
+    if(!queryfilename.empty())cout<<"query points: "<<queryfilename<<endl;
+    if(!kcache_dir.empty())cout<<"K cache directory: "<<kcache_dir<<endl;
+    if(isshiftinvert)cout<<"shift-invert eigensolver: "<<isshiftinvert<<endl;
+
+    /* a model file from -m: the solve is skipped */
+    bool ismodel = ext==".vipss";
 
 
     vector<double>Vs;
     RBF_Core rbf_core;
     RBF_Paras para = Set_RBF_PARA();
     para.user_lamnbda = user_lambda;
+    para.ismemorylean = ismemorylean;
+    para.isneedcoef = issurfacing || issavemodel || !queryfilename.empty();
+    para.isconcurrentsearch = isconcurrentsearch;
+    para.ismixedprecision = ismixedprecision;
+    para.treecode_theta = treecode_theta;
+    para.surf_tolerance = surf_tolerance;
+    para.isnarrowband = isnarrowband;
+    para.adaptive_error = adaptive_error;
+    para.ply_format = ply_format;
+    para.isstreamsurface = isstreamsurface;
+    para.kcache_dir = kcache_dir;
+    if(isshiftinvert)para.eigensolver = EIG_SHIFTINVERT;
+    if(support_ratio>0){
+        para.isusesparse = true;
+        para.sparse_para = support_ratio;
+        para.Kernal = Wendland;
+    }
 
-    readXYZ(infilename,Vs);
-    rbf_core.InjectData(Vs,para);
-    rbf_core.BuildK(para);
-    rbf_core.InitNormal(para);
-    rbf_core.OptNormal(0);
+    if(ismodel){
+        if(!rbf_core.Read_Model(infilename,para))return 1;
+    }else{
+        readXYZ(infilename,Vs);
+        rbf_core.InjectData(Vs,para);
+        rbf_core.BuildK(para);
+        rbf_core.InitNormal(para);
+        rbf_core.OptNormal(0);
+        if(rbf_core.issparsefailed){
+            cout<<"sparse solve failed, stopped"<<endl;
+            return 1;
+        }
+
+        rbf_core.Write_Hermite_NormalPrediction(outpath+pcname+"_normal", 1);
+        if(issavemodel)rbf_core.Write_Model(outpath+pcname+"_model");
+    }
 
-    rbf_core.Write_Hermite_NormalPrediction(outpath+pcname+"_normal", 1);
+    if(!queryfilename.empty())rbf_core.Evaluate_Points(queryfilename,outpath+pcname+"_values");
 
     if(issurfacing){
-        rbf_core.Surfacing(0,n_voxel_line);
-        rbf_core.Write_Surface(outpath+pcname+"_surface");
+        if(n_voxel_levels.empty())n_voxel_levels.push_back(n_voxel_line);
+        if(n_voxel_levels.size()>1 || isstreamsurface)rbf_core.Surfacing(0,n_voxel_levels,outpath+pcname+"_surface");
+        else rbf_core.Surfacing(0,n_voxel_line);
+        if(!isstreamsurface)rbf_core.Write_Surface(outpath+pcname+"_surface");
     }
 
+    rbf_core.Print_MemRecord();
+
 
 
 
@@ -4,6 +4,7 @@
 #include <ctime>
 #include <chrono>
 #include <iomanip>
+#include <random>
 //#include <eigen3/Eigen/CholmodSupport>
 //#include <gurobi_c++.h>
 
@@ -183,12 +184,13 @@ int Solver::nloptwrapper(vector<double>&lowerbound,
                ){
 
 
-    nlopt::result result;
+    nlopt::result result = nlopt::FAILURE;
     sol.Statue=0;
     vector<double>tmp_grad(0);
 
-    sol.init_energy = optfunc(sol.solveval,tmp_grad,funcPara);
     try{
+        /* inside the try: optfunc may throw nlopt::forced_stop */
+        sol.init_energy = optfunc(sol.solveval,tmp_grad,funcPara);
         int numOfPara = lowerbound.size();
         //nlopt::opt myopt(nlopt::LD_VAR1,uint(numOfPara));
         //nlopt::opt myopt(nlopt::LD_CCSAQ,uint(numOfPara));
@@ -244,6 +246,125 @@ int Solver::nloptwrapper(vector<double>&lowerbound,
 
 
 
+/* LOBPCG_Smallest: locally optimal block preconditioned conjugate gradient for the smallest
+ * eigenpair, the search space [X W P] is kept orthonormal so that the Rayleigh-Ritz step is a
+ * plain 3m x 3m eig_sym; each iteration costs one application of op to a block of m vectors
+ * converged when |A x - theta x| < tor * |A|, return false otherwise or if op failed */
+bool Solver::LOBPCG_Smallest(std::function<bool(const arma::mat &X, arma::mat &Y)>op,
+                             int n,
+                             int blocksize,
+                             double tor,
+                             int maxIter,
+                             double &eigval,
+                             arma::vec &eigvec
+                             ){
+
+    int m = max(1, min(blocksize, n/3));
+    arma::mat X(n,m), AX, W, AW, P, AP, Q, Rq, R;
+    arma::vec theta;
+
+    std::mt19937 gen(1);
+    std::normal_distribution<double>nd(0.,1.);
+    for(arma::uword i=0;i<X.n_elem;++i)X(i) = nd(gen);
+    if(eigvec.n_elem == n)X.col(0) = eigvec;
+
+    /* |A| by a few power steps */
+    double normA = 0;
+    {
+        arma::mat v = X.col(m-1), Av;
+        for(int i=0;i<8;++i){
+            v /= arma::norm(v);
+            if(!op(v,Av))return false;
+            normA = arma::norm(Av);
+            v = Av;
+        }
+        if(normA==0){
+            eigval = 0;
+            eigvec = X.col(0) / arma::norm(X.col(0));
+            return true;
+        }
+    }
+
+    arma::qr_econ(Q,Rq,X);
+    X = Q;
+    if(!op(X,AX))return false;
+    {
+        arma::mat H = X.t()*AX, C;
+        H = (H + H.t()) / 2;
+        arma::eig_sym(theta,C,H);
+        X = X*C;
+        AX = AX*C;
+    }
+
+    bool isconverged = false;
+    int it = 0;
+    double res = 0;
+    for(;it<maxIter;++it){
+
+        R = AX - X.each_row() % theta.t();
+        res = arma::norm(R.col(0));
+        if(res <= tor * normA){
+            isconverged = true;
+            break;
+        }
+
+        W = R;
+        for(int k=0;k<2;++k)W -= X*(X.t()*W);
+        arma::qr_econ(Q,Rq,W);
+        W = Q;
+        if(!op(W,AW))return false;
+
+        if(P.n_cols){
+            arma::mat cx = X.t()*P, cw = W.t()*P;
+            P -= X*cx + W*cw;
+            AP -= AX*cx + AW*cw;
+            arma::qr_econ(Q,Rq,P);
+            arma::vec rd = arma::abs(Rq.diag());
+            if(rd.min() < 1e-10 * rd.max()){
+                P.reset();
+                AP.reset();
+            }else{
+                P = Q;
+                AP = arma::solve(arma::trimatl(Rq.t()), AP.t()).t();
+            }
+        }
+
+        arma::mat S, AS;
+        if(P.n_cols){
+            S = arma::join_rows(arma::join_rows(X,W),P);
+            AS = arma::join_rows(arma::join_rows(AX,AW),AP);
+        }else{
+            S = arma::join_rows(X,W);
+            AS = arma::join_rows(AX,AW);
+        }
+
+        arma::mat H = S.t()*AS, Y;
+        H = (H + H.t()) / 2;
+        arma::vec th;
+        arma::eig_sym(th,Y,H);
+
+        arma::mat C = Y.cols(0,m-1);
+        theta = th.subvec(0,m-1);
+        arma::mat Cr = C.rows(m,C.n_rows-1);
+        P = S.cols(m,S.n_cols-1) * Cr;
+        AP = AS.cols(m,AS.n_cols-1) * Cr;
+        X = X*C.rows(0,m-1) + P;
+        AX = AX*C.rows(0,m-1) + AP;
+
+        /* refresh A*X now and then against accumulated round-off */
+        if(it%50==49 && !op(X,AX))return false;
+    }
+
+    cout<<"LOBPCG: "<<it<<" iterations, residual "<<res/normA<<(isconverged?"":" (not converged)")<<endl;
+
+    eigval = theta(0);
+    eigvec = X.col(0);
+    return isconverged;
+}
+
+
+
+
 //int solveQuadraticProgramming_Core(GRBModel &model, vector<GRBVar>&vars, Solution_Struct &sol, bool suppressinfo = false){
 
 //    int n = vars.size();
@@ -6,6 +6,7 @@
 #include <vector>
 #include <armadillo>
 #include <nlopt.hpp>
+#include <functional>
 
 
 using namespace std;
@@ -134,6 +135,17 @@ public:
                    Solution_Struct &sol
                    );
 
+    /* smallest eigenpair of the symmetric operator op (Y = A*X for a block X of n rows, false if it
+     * failed, which stops the iteration) */
+    static bool LOBPCG_Smallest(std::function<bool(const arma::mat &X, arma::mat &Y)>op,
+                                int n,
+                                int blocksize,
+                                double tor,
+                                int maxIter,
+                                double &eigval,
+                                arma::vec &eigvec
+                                );
+
 };
 
 
@@ -0,0 +1,79 @@
+#ifndef LAPACK_WRAPPER_H
+#define LAPACK_WRAPPER_H
+
+#include <armadillo>
+
+/* raw BLAS/LAPACK entries that armadillo does not expose through its public interface
+ * the libraries are the ones armadillo is already linked against */
+
+typedef arma::blas_int lapack_int;
+
+extern "C" {
+
+/* symmetric indefinite (Bunch-Kaufman LDL^T) factorization and inverse */
+void dsytrf_(const char *uplo, const lapack_int *n, double *a, const lapack_int *lda,
+             lapack_int *ipiv, double *work, const lapack_int *lwork, lapack_int *info);
+
+void dsytri2_(const char *uplo, const lapack_int *n, double *a, const lapack_int *lda,
+              const lapack_int *ipiv, double *work, const lapack_int *lwork, lapack_int *info);
+
+/* symmetric matrix times a block of vectors, only one triangle of a is read */
+void dsymm_(const char *side, const char *uplo, const lapack_int *m, const lapack_int *n,
+            const double *alpha, const double *a, const lapack_int *lda, const double *b, const lapack_int *ldb,
+            const double *beta, double *c, const lapack_int *ldc);
+
+/* symmetric matrix times a vector, only one triangle of a is read */
+void dsymv_(const char *uplo, const lapack_int *n, const double *alpha, const double *a, const lapack_int *lda,
+            const double *x, const lapack_int *incx, const double *beta, double *y, const lapack_int *incy);
+
+void ssymv_(const char *uplo, const lapack_int *n, const float *alpha, const float *a, const lapack_int *lda,
+            const float *x, const lapack_int *incx, const float *beta, float *y, const lapack_int *incy);
+
+/* Cholesky factorization and the matching solve */
+void dpotrf_(const char *uplo, const lapack_int *n, double *a, const lapack_int *lda, lapack_int *info);
+
+void dpotrs_(const char *uplo, const lapack_int *n, const lapack_int *nrhs, const double *a, const lapack_int *lda,
+             double *b, const lapack_int *ldb, lapack_int *info);
+
+/* thread control of the BLAS, named at configure time by VIPSS_BLAS (see CMakeLists.txt) */
+#if defined(VIPSS_BLAS_OPENBLAS)
+void openblas_set_num_threads(int num_threads);
+int openblas_get_num_threads(void);
+#elif defined(VIPSS_BLAS_MKL)
+void MKL_Set_Num_Threads(int nth);
+int MKL_Get_Max_Threads(void);
+int MKL_Set_Num_Threads_Local(int nth);
+#endif
+
+}
+
+/* Blas_Set_Num_Threads: threads of every BLAS call of the process, set before a parallel region;
+ * Blas_Set_Num_Threads_Local: threads of the BLAS calls of the calling thread, set inside it (0 goes back
+ * to the process setting). Both return the previous value, or 0 when the BLAS has no such control:
+ * OpenBLAS only has the process setting, MKL has both; any other BLAS is left alone, and only an
+ * OpenMP-threaded one then follows the omp_set_num_threads of the calling thread */
+inline int Blas_Set_Num_Threads(int n){
+#if defined(VIPSS_BLAS_OPENBLAS)
+    int prev = openblas_get_num_threads();
+    openblas_set_num_threads(n);
+    return prev;
+#elif defined(VIPSS_BLAS_MKL)
+    int prev = MKL_Get_Max_Threads();
+    MKL_Set_Num_Threads(n);
+    return prev;
+#else
+    (void)n;
+    return 0;
+#endif
+}
+
+inline int Blas_Set_Num_Threads_Local(int n){
+#if defined(VIPSS_BLAS_MKL)
+    return MKL_Set_Num_Threads_Local(n);
+#else
+    (void)n;
+    return 0;
+#endif
+}
+
+#endif // LAPACK_WRAPPER_H
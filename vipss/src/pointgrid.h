@@ -0,0 +1,83 @@
+#ifndef POINTGRID_H
+#define POINTGRID_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+/* PointGrid: uniform grid of cell size cell over a point set, the points of a cell are
+ * order[begin,end); used for the neighbor searches of the compactly supported kernels */
+class PointGrid{
+public:
+    double cell = 0;
+    double origin[3];
+    vector<int>order;
+    unordered_map<long long, pair<int,int>>cells;
+
+    static long long Key(int x, int y, int z){
+        return ((long long)(x+(1<<20))<<42) | ((long long)(y+(1<<20))<<21) | (long long)(z+(1<<20));
+    }
+
+    void Build(const vector<double>&pts, double cell){
+
+        int npt = pts.size()/3;
+        this->cell = cell;
+        for(int k=0;k<3;++k){
+            origin[k] = npt ? pts[k] : 0;
+            for(int i=0;i<npt;++i)origin[k] = min(origin[k], pts[i*3+k]);
+        }
+
+        vector<long long>keys(npt);
+        for(int i=0;i<npt;++i){
+            int c[3];
+            for(int k=0;k<3;++k)c[k] = (int)floor((pts[i*3+k]-origin[k])/cell);
+            keys[i] = Key(c[0],c[1],c[2]);
+        }
+
+        order.resize(npt);
+        for(int i=0;i<npt;++i)order[i] = i;
+        sort(order.begin(),order.end(),[&](int i, int j){return keys[i]<keys[j];});
+
+        cells.clear();
+        for(int be=0;be<npt;){
+            int ed = be;
+            while(ed<npt && keys[order[ed]]==keys[order[be]])++ed;
+            cells[keys[order[be]]] = make_pair(be,ed);
+            be = ed;
+        }
+    }
+
+    /* call f(i) for every point i in the 27 cells around p, a superset of the points within cell of p */
+    template<class F>
+    void Visit(const double *p, F f) const{
+        int c[3];
+        for(int k=0;k<3;++k)c[k] = (int)floor((p[k]-origin[k])/cell);
+        for(int dx=-1;dx<=1;++dx)for(int dy=-1;dy<=1;++dy)for(int dz=-1;dz<=1;++dz){
+            auto it = cells.find(Key(c[0]+dx,c[1]+dy,c[2]+dz));
+            if(it==cells.end())continue;
+            for(int t=it->second.first;t<it->second.second;++t)f(order[t]);
+        }
+    }
+
+    /* same cells, as the ranges [be,ed) of order, for a caller that keeps its data in grid order */
+    template<class F>
+    void Visit_Ranges(const double *p, F f) const{
+        int c[3];
+        for(int k=0;k<3;++k)c[k] = (int)floor((p[k]-origin[k])/cell);
+        for(int dx=-1;dx<=1;++dx)for(int dy=-1;dy<=1;++dy)for(int dz=-1;dz<=1;++dz){
+            auto it = cells.find(Key(c[0]+dx,c[1]+dy,c[2]+dz));
+            if(it!=cells.end())f(it->second.first, it->second.second);
+        }
+    }
+
+    void Clear(){
+        order.clear();
+        cells.clear();
+        cell = 0;
+    }
+};
+
+#endif // POINTGRID_H
@@ -11,6 +11,11 @@
 #include <algorithm>
 #include <queue>
 #include "readers.h"
+#include "lapack_wrapper.h"
+#include "vecmath.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 //#include "mymesh/UnionFind.h"
 //#include "mymesh/tinyply.h"
 
@@ -77,7 +82,7 @@ bool RBF_Core::Write_Hermite_NormalPrediction(string fname, int mode){
     //writePLYFile(fname,pts,f2v,nors,labelcolor);
 
 //    writeObjFile_vn(fname,pts,nors);
-    writePLYFile_VN(fname,pts,nors);
+    writePLYFile_VN(fname,pts,nors,ply_format);
 
     return 1;
 }
@@ -92,48 +97,10 @@ void RBF_Core::Set_HermiteRBF(vector<double>&pts){
 
     a.set_size(npt*4);
     M.set_size(npt*4,npt*4);
-    double *p_pts = pts.data();
-    for(int i=0;i<npt;++i){
-        for(int j=i;j<npt;++j){
-            M(i,j) = M(j,i) = Kernal_Function_2p(p_pts+i*3, p_pts+j*3);
-        }
-    }
-
-
-    //if(User_Lamnbda!=0)for(int i=0;i<npt;++i)M(i,i) += User_Lamnbda;
 
-
-    double G[3];
-    for(int i=0;i<npt;++i){
-        for(int j=0;j<npt;++j){
-
-            Kernal_Gradient_Function_2p(p_pts+i*3, p_pts+j*3, G);
-            //            int jind = j*3+npt;
-            //            for(int k=0;k<3;++k)M(i,jind+k) = -G[k];
-            //            for(int k=0;k<3;++k)M(jind+k,i) = G[k];
-
-            for(int k=0;k<3;++k)M(i,npt+j+k*npt) = G[k];
-            for(int k=0;k<3;++k)M(npt+j+k*npt,i) = G[k];
-
-        }
-    }
-
-    double H[9];
-    for(int i=0;i<npt;++i){
-        for(int j=i;j<npt;++j){
-
-            Kernal_Hessian_Function_2p(p_pts+i*3, p_pts+j*3, H);
-            //            int iind = i*3+npt;
-            //            int jind = j*3+npt;
-            //            for(int k=0;k<3;++k)
-            //                for(int l=0;l<3;++l)
-            //                    M(jind+l,iind+k) = M(iind+k,jind+l) = -H[k*3+l];
-
-            for(int k=0;k<3;++k)
-                for(int l=0;l<3;++l)
-                    M(npt+j+l*npt,npt+i+k*npt) = M(npt+i+k*npt,npt+j+l*npt) = -H[k*3+l];
-        }
-    }
+    auto t0 = Clock::now();
+    Assemble_HermiteRBF(pts.data());
+    cout<<"assemble M: "<<std::chrono::nanoseconds(Clock::now() - t0).count()/1e9<<endl;
 
     //cout<<std::setprecision(5)<<std::fixed<<M<<endl;
 
@@ -184,6 +151,60 @@ void RBF_Core::Set_HermiteRBF(vector<double>&pts){
 }
 
 
+/* Assemble_HermiteRBF: fill the 4n x 4n Hermite matrix M
+ * the point pairs (i,j), i<=j, are walked in square tiles of HERMITE_TILE points so that
+ * the value, gradient and Hessian entries written by one tile stay within a cache-sized window
+ * of M; each pair is evaluated once, the gradient block uses G(pj,pi) = -G(pi,pj),
+ * and the tiles are distributed over all threads */
+#define HERMITE_TILE 64
+void RBF_Core::Assemble_HermiteRBF(const double *p_pts){
+
+    const int n = npt;
+    const arma::uword ld = M.n_rows;
+    double *p_M = M.memptr();
+
+    int ntile = (n + HERMITE_TILE - 1) / HERMITE_TILE;
+    vector<pair<int,int>>tiles;
+    tiles.reserve(ntile*(ntile+1)/2);
+    for(int bi=0;bi<ntile;++bi)for(int bj=bi;bj<ntile;++bj)tiles.push_back(make_pair(bi,bj));
+
+#pragma omp parallel for schedule(dynamic)
+    for(int t=0;t<(int)tiles.size();++t){
+        const int ibe = tiles[t].first * HERMITE_TILE, ied = min(n, ibe + HERMITE_TILE);
+        const int jbe = tiles[t].second * HERMITE_TILE, jed = min(n, jbe + HERMITE_TILE);
+        double v, G[3], H[9];
+        for(int j=jbe;j<jed;++j){
+            const double *p_j = p_pts+j*3;
+            const int iend = tiles[t].first == tiles[t].second ? j+1 : ied;
+            for(int i=ibe;i<iend;++i){
+                const double *p_i = p_pts+i*3;
+                if(Kernal_Fused_Function_2p)Kernal_Fused_Function_2p(p_i, p_j, &v, G, H);
+                else{
+                    v = Kernal_Function_2p(p_i, p_j);
+                    Kernal_Gradient_Function_2p(p_i, p_j, G);
+                    Kernal_Hessian_Function_2p(p_i, p_j, H);
+                }
+
+                p_M[i + j*ld] = p_M[j + i*ld] = v;
+
+                for(int k=0;k<3;++k){
+                    const arma::uword ci = n+i+k*n, cj = n+j+k*n;
+                    p_M[i + cj*ld] = p_M[cj + i*ld] = G[k];
+                    p_M[j + ci*ld] = p_M[ci + j*ld] = -G[k];
+                }
+
+                for(int k=0;k<3;++k)
+                    for(int l=0;l<3;++l){
+                        const arma::uword ci = n+i+k*n, cj = n+j+l*n;
+                        p_M[cj + ci*ld] = p_M[ci + cj*ld] = -H[k*3+l];
+                    }
+            }
+        }
+    }
+
+}
+
+
 double Gaussian_2p(const double *p1, const double *p2, double sigma){
 
     return exp(-MyUtility::vecSquareDist(p1,p2)/(2*sigma*sigma));
@@ -213,19 +234,85 @@ void RBF_Core::Set_User_Lamnda_ToMatrix(double user_ls){
         Set_Actual_User_LSCoef(user_ls);
         auto t1 = Clock::now();
         cout<<"setting K, HermiteApprox_Lamnda"<<endl;
-        if(User_Lamnbda>0){
+        if(User_Lamnbda>0 && isspectral){
+
+            Set_K00_Spectral();
+            if(islean)Spectral_Lamnda_ToMatrix(User_Lamnbda, finalH);
+            else{
+                Spectral_Lamnda_ToMatrix(User_Lamnbda, K);
+                saveK_finalH = K;
+            }
+
+        }else if(User_Lamnbda>0){
             arma::sp_mat eye;
             eye.eye(npt,npt);
 
             dI = inv(eye + User_Lamnbda*K00);
-            saveK_finalH = K = K11 - (User_Lamnbda)*(K01.t()*dI*K01);
+            if(islean)finalH = K11 - (User_Lamnbda)*(K01.t()*dI*K01);
+            else saveK_finalH = K = K11 - (User_Lamnbda)*(K01.t()*dI*K01);
 
-        }else saveK_finalH = K = K11;
+        }else if(islean)finalH.swap(K11);
+        else saveK_finalH = K = K11;
         cout<<"solved: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
     }
 
-    finalH = saveK_finalH;
+    /* lean: finalH is the only copy, K stays empty until a lambda candidate needs its own,
+     * and with a zero user lambda finalH takes over the storage of K11 */
+    if(islean)K.reset();
+    else finalH = saveK_finalH;
+    Mem_Checkpoint("BuildK");
+
+}
+
+/* Set_K00_Spectral: K00 = Q diag(mu) Q^T, computed once and shared by every lambda,
+ * K01_spec = Q^T K01 so that
+ * K(lambda) = K11 - lambda K01^T (I + lambda K00)^-1 K01 = K11 - K01_spec^T diag(lambda/(1+lambda mu)) K01_spec */
+void RBF_Core::Set_K00_Spectral(){
+
+    if(!K00_eigval.is_empty())return;
+    auto t1 = Clock::now();
+    eig_sym(K00_eigval, K00_eigvec, K00, "dc");
+    K01_spec = K00_eigvec.t() * K01;
+    if(islean){
+        K00.reset();
+        K01.reset();
+    }
+    cout<<"K00 eigendecomposition: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
+}
+
+/* Spectral_Lamnda_ToMatrix: outK = K(lambda) from the spectral factors,
+ * the diagonal is split by sign so both updates are Gram products (syrk) */
+void RBF_Core::Spectral_Lamnda_ToMatrix(double lamnbda, arma::mat &outK){
+
+    const arma::mat &K11_r = K11.is_empty() ? finalH : K11;
+    arma::vec d = lamnbda / (1 + lamnbda * K00_eigval);
 
+    arma::uvec ind = arma::find(d > 0);
+    arma::mat W = K01_spec.rows(ind);
+    W.each_col() %= arma::sqrt(d.elem(ind));
+    outK = K11_r - W.t() * W;
+
+    ind = arma::find(d < 0);
+    if(ind.n_elem){
+        W = K01_spec.rows(ind);
+        W.each_col() %= arma::sqrt(-d.elem(ind));
+        outK += W.t() * W;
+    }
+}
+
+/* Lamnda_ToMatrix: outK = K11 - lamnbda K01^T (I + lamnbda K00)^-1 K01, only reads the K blocks */
+void RBF_Core::Lamnda_ToMatrix(double lamnbda, arma::mat &outK){
+
+    if(isspectral){
+        Set_K00_Spectral();
+        Spectral_Lamnda_ToMatrix(lamnbda, outK);
+        return;
+    }
+    const arma::mat &K11_r = K11.is_empty() ? finalH : K11;
+    arma::sp_mat eye;
+    eye.eye(npt,npt);
+    arma::mat tmpdI = inv(eye + lamnbda*K00);
+    outK = K11_r - lamnbda*(K01.t()*tmpdI*K01);
 }
 
 void RBF_Core::Set_HermiteApprox_Lamnda(double hermite_ls){
@@ -235,17 +322,18 @@ void RBF_Core::Set_HermiteApprox_Lamnda(double hermite_ls){
         Set_Actual_Hermite_LSCoef(hermite_ls);
         auto t1 = Clock::now();
         cout<<"setting K, HermiteApprox_Lamnda"<<endl;
-        if(ls_coef>0){
-            arma::sp_mat eye;
-            eye.eye(npt,npt);
-
+        if(isuse_sparse){
+            if(ls_coef>0){
+                if(!sp_K.Set(sp_M, N, ls_coef+User_Lamnbda))issparsefailed = true;
+            }else sp_K.Clear();
+        }else if(ls_coef>0){
             if(ls_coef > 0){
-                arma:: mat tmpdI = inv(eye + (ls_coef+User_Lamnbda)*K00);
-                K = K11 - (ls_coef+User_Lamnbda)*(K01.t()*tmpdI*K01);
+                Lamnda_ToMatrix(ls_coef+User_Lamnbda, K);
             }else{
                 K = saveK_finalH;
             }
-        }
+        }else if(islean)K.reset();
+        Mem_Checkpoint("InitNormal");
         cout<<"solved: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;    
     }
 
@@ -254,11 +342,54 @@ void RBF_Core::Set_HermiteApprox_Lamnda(double hermite_ls){
 
 
 
-void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
+/* Inverse_SymIndefinite: invert the symmetric (indefinite) matrix A in place
+ * through its LDL^T factorization, only the lower triangle of A is referenced;
+ * about half the flops of the LU based inv() and no second n x n buffer
+ * return false if A is singular, A is overwritten in any case */
+bool Inverse_SymIndefinite(arma::mat &A){
+
+    const char uplo = 'L';
+    lapack_int n = A.n_rows, lda = A.n_rows, info = 0, lwork = -1;
+    vector<lapack_int>ipiv(n);
+    double wquery = 0;
+
+    dsytrf_(&uplo, &n, A.memptr(), &lda, ipiv.data(), &wquery, &lwork, &info);
+    lwork = max(lapack_int(wquery), n);
+    vector<double>work(lwork);
+    dsytrf_(&uplo, &n, A.memptr(), &lda, ipiv.data(), work.data(), &lwork, &info);
+    if(info!=0){
+        cout<<"dsytrf info: "<<info<<endl;
+        return false;
+    }
+
+    lwork = -1;
+    dsytri2_(&uplo, &n, A.memptr(), &lda, ipiv.data(), &wquery, &lwork, &info);
+    lwork = max(lapack_int(wquery), (n+66)*(64+3));
+    work.resize(lwork);
+    dsytri2_(&uplo, &n, A.memptr(), &lda, ipiv.data(), work.data(), &lwork, &info);
+    if(info!=0){
+        cout<<"dsytri2 info: "<<info<<endl;
+        return false;
+    }
+
+    double *p_A = A.memptr();
+#pragma omp parallel for schedule(dynamic)
+    for(lapack_int j=0;j<n;++j)
+        for(lapack_int i=j+1;i<n;++i)p_A[j + i*lda] = p_A[i + j*lda];
+
+    return true;
+}
 
+void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 
 
-    Set_HermiteRBF(pts);
+    if(isuse_sparse){
+        Set_Hermite_PredictNormal_Sparse(pts);
+        return;
+    }
+    /* the inverse only depends on the points and the kernel, it may be in the cache of an earlier run */
+    bool iscached = isnewformula && Read_KCache(pts);
+    if(!iscached)Set_HermiteRBF(pts);
 
     auto t1 = Clock::now();
     cout<<"setting K"<<endl;
@@ -272,26 +403,57 @@ void RBF_Core::Set_Hermite_PredictNormal(vector<double>&pts){
 
     }else{
         cout<<"using new formula"<<endl;
-        bigM.zeros((npt+1)*4,(npt+1)*4);
-        bigM.submat(0,0,npt*4-1,npt*4-1) = M;
-        bigM.submat(0,npt*4,(npt)*4-1, (npt+1)*4-1) = N;
-        bigM.submat(npt*4,0,(npt+1)*4-1, (npt)*4-1) = N.t();
-
-        //for(int i=0;i<4;++i)bigM(i+(npt)*4,i+(npt)*4) = 1;
-
-        auto t2 = Clock::now();
-        bigMinv = inv(bigM);
-        cout<<"bigMinv: "<<(setK_time= std::chrono::nanoseconds(Clock::now() - t2).count()/1e9)<<endl;
-		bigM.clear();
-        Minv = bigMinv.submat(0,0,npt*4-1,npt*4-1);
-        Ninv = bigMinv.submat(0,npt*4,(npt)*4-1, (npt+1)*4-1);
-
-        bigMinv.clear();
-        //K = Minv - Ninv *(N.t()*Minv);
-        K = Minv;
-        K00 = K.submat(0,0,npt-1,npt-1);
-        K01 = K.submat(0,npt,npt-1,npt*4-1);
-        K11 = K.submat( npt, npt, npt*4-1, npt*4-1 );
+        if(!iscached){
+            auto Set_BigM = [&](){
+                if(M.is_empty())Set_HermiteRBF(pts);
+                bigM.zeros((npt+1)*4,(npt+1)*4);
+                bigM.submat(0,0,npt*4-1,npt*4-1) = M;
+                bigM.submat(0,npt*4,(npt)*4-1, (npt+1)*4-1) = N;
+                bigM.submat(npt*4,0,(npt+1)*4-1, (npt)*4-1) = N.t();
+            };
+            Set_BigM();
+            Mem_Checkpoint("BuildK");
+            if(islean)M.reset();
+
+            //for(int i=0;i<4;++i)bigM(i+(npt)*4,i+(npt)*4) = 1;
+
+            auto t2 = Clock::now();
+            if(isldlt && Inverse_SymIndefinite(bigM))bigMinv.swap(bigM);
+            else{
+                if(isldlt){
+                    cout<<"LDLt failed, fall back to inv"<<endl;
+                    Set_BigM();
+                }
+                bigMinv = inv(bigM);
+            }
+            cout<<"bigMinv: "<<(setK_time= std::chrono::nanoseconds(Clock::now() - t2).count()/1e9)<<endl;
+            bigM.clear();
+            Mem_Checkpoint("BuildK");
+            Write_KCache(pts, bigMinv);
+            if(!islean){
+                Minv = bigMinv.submat(0,0,npt*4-1,npt*4-1);
+                Ninv = bigMinv.submat(0,npt*4,(npt)*4-1, (npt+1)*4-1);
+
+                bigMinv.clear();
+                //K = Minv - Ninv *(N.t()*Minv);
+                K = Minv;
+                K00 = K.submat(0,0,npt-1,npt-1);
+                K01 = K.submat(0,npt,npt-1,npt*4-1);
+                K11 = K.submat( npt, npt, npt*4-1, npt*4-1 );
+            }else{
+                /* lean: slice straight out of bigMinv, no K = Minv copy,
+                 * Minv/Ninv are only kept if the coefficients will be solved */
+                if(isneedcoef){
+                    Minv = bigMinv.submat(0,0,npt*4-1,npt*4-1);
+                    Ninv = bigMinv.submat(0,npt*4,(npt)*4-1, (npt+1)*4-1);
+                }
+                K00 = bigMinv.submat(0,0,npt-1,npt-1);
+                K01 = bigMinv.submat(0,npt,npt-1,npt*4-1);
+                K11 = bigMinv.submat( npt, npt, npt*4-1, npt*4-1 );
+                Mem_Checkpoint("BuildK");
+                bigMinv.reset();
+            }
+        }
 
         M.clear();N.clear();
         cout<<"K11: "<<K11.n_cols<<endl;
@@ -328,13 +490,73 @@ void RBF_Core::SetInitnormal_Uninorm(){
 
 }
 
+/* Solve_SmallestEigen: smallest eigenpair of the symmetric matrix A by LOBPCG,
+ * EIG_LOBPCG only needs products with A (one triangle read, dsymm), no copy of A,
+ * EIG_SHIFTINVERT iterates on -(A + delta I)^-1 through a Cholesky factor of A, held in a copy of A
+ * (faster convergence, but one more 3n x 3n matrix at the peak)
+ * return false if the iteration did not converge */
+bool RBF_Core::Solve_SmallestEigen(const arma::mat &A, double &eigval, arma::vec &eigvec){
+
+    const lapack_int n = A.n_rows;
+    const char uplo = 'L', side = 'L';
+    double theta;
+    auto t1 = Clock::now();
+    bool re = false;
+
+    if(eigensolver==EIG_SHIFTINVERT){
+        arma::mat L = A;
+        double delta = 1e-10 * arma::norm(A,"inf");
+        L.diag() += delta;
+        lapack_int info = 0;
+        dpotrf_(&uplo, &n, L.memptr(), &n, &info);
+        if(info==0){
+            auto op = [&](const arma::mat &X, arma::mat &Y){
+                Y = -X;
+                lapack_int nrhs = Y.n_cols;
+                dpotrs_(&uplo, &n, &nrhs, L.memptr(), &n, Y.memptr(), &n, &info);
+                return info==0;
+            };
+            re = Solver::LOBPCG_Smallest(op, n, 4, 1e-8, 200, theta, eigvec);
+            eigval = -1/theta - delta;
+        }else cout<<"shift-invert: K + delta I is not positive definite, use plain LOBPCG"<<endl;
+    }
+    if(!re){
+        auto op = [&](const arma::mat &X, arma::mat &Y){
+            Y.set_size(n, X.n_cols);
+            lapack_int ncol = X.n_cols;
+            double alpha = 1, beta = 0;
+            dsymm_(&side, &uplo, &n, &ncol, &alpha, A.memptr(), &n, X.memptr(), &n, &beta, Y.memptr(), &n);
+            return true;
+        };
+        re = Solver::LOBPCG_Smallest(op, n, 4, 1e-6, 1000, eigval, eigvec);
+    }
+    cout<<"smallest eigenpair: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
+    return re;
+}
+
 int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(){
 
+    if(isuse_sparse)Solve_Hermite_PredictNormal_Sparse(sp_K.IsSet() ? sp_K : sp_H, initnormals);
+    else Solve_Hermite_PredictNormal_UnitNorm(K.is_empty() ? finalH : K, initnormals);
+
+    SetInitnormal_Uninorm();
+    cout<<"Solve_Hermite_PredictNormal_UnitNorm finish"<<endl;
+    return 1;
+}
+
+int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(const arma::mat &Kr, vector<double>&outnormals){
+
     arma::vec eigval, ny;
     arma::mat eigvec;
 
     if(!isuse_sparse){
-        ny = eig_sym( eigval, eigvec, K);
+        double smallval;
+        arma::vec smallvec;
+        if(eigensolver!=EIG_FULL && Solve_SmallestEigen(Kr, smallval, smallvec)){
+            eigval.set_size(1);
+            eigval(0) = smallval;
+            eigvec = smallvec;
+        }else ny = eig_sym( eigval, eigvec, Kr);
     }else{
 //		cout<<"use sparse eigen"<<endl;
 //        int k = 4;
@@ -349,20 +571,17 @@ int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(){
 
     int smalleig = 0;
 
-    initnormals.resize(npt*3);
+    outnormals.resize(npt*3);
     arma::vec y(npt*4);
     for(int i=0;i<npt;++i)y(i) = 0;
     for(int i=0;i<npt*3;++i)y(i+npt) = eigvec(i,smalleig);
     for(int i=0;i<npt;++i){
-        initnormals[i*3]   = y(npt+i);
-        initnormals[i*3+1] = y(npt+i+npt);
-        initnormals[i*3+2] = y(npt+i+npt*2);
+        outnormals[i*3]   = y(npt+i);
+        outnormals[i*3+1] = y(npt+i+npt);
+        outnormals[i*3+2] = y(npt+i+npt*2);
         //MyUtility::normalize(normals.data()+i*3);
     }
 
-
-    SetInitnormal_Uninorm();
-    cout<<"Solve_Hermite_PredictNormal_UnitNorm finish"<<endl;
     return 1;
 }
 
@@ -370,83 +589,158 @@ int RBF_Core::Solve_Hermite_PredictNormal_UnitNorm(){
 
 /***************************************************************************************************/
 /***************************************************************************************************/
-double acc_time;
+void HermiteOpt_Workspace::Reset(const arma::fmat *Hf, bool issingle, int n){
+
+    Reset((const arma::mat*)NULL, n);
+    this->Hf = Hf;
+    this->issingle = issingle;
+    if(issingle){
+        x3f.resize(n*3); Hx3f.resize(n*3);
+    }
+}
+
+/* y = A x for a symmetric A stored in float, with the sums in double; A is full, so that
+ * y(i) is the dot of the contiguous column i with x */
+static void Symv_FloatStorage(const arma::fmat &A, const double *x, double *y){
+
+    int N = A.n_rows;
+#pragma omp parallel for schedule(static)
+    for(int i=0;i<N;++i){
+        const float *pa = A.colptr(i);
+        double re = 0;
+        for(int j=0;j<N;++j)re += pa[j] * x[j];
+        y[i] = re;
+    }
+}
+
+void HermiteOpt_Workspace::Reset(SparseHermite_Operator *Hop, int n){
+
+    Reset((const arma::mat*)NULL, n);
+    this->Hop = Hop;
+}
+
+void HermiteOpt_Workspace::Reset(const arma::mat *H, int n){
+
+    this->Hop = NULL;
+    this->H = H;
+    this->Hf = NULL;
+    this->issingle = false;
+    this->isfailed = false;
+    this->n = n;
+    countopt = 0;
+    acc_time = 0;
+    sina.resize(n); cosa.resize(n);
+    sinb.resize(n); cosb.resize(n);
+    x3.resize(n*3); Hx3.resize(n*3);
+}
 
-static int countopt = 0;
 double optfunc_Hermite(const vector<double>&x, vector<double>&grad, void *fdata){
 
     auto t1 = Clock::now();
-    RBF_Core *drbf = reinterpret_cast<RBF_Core*>(fdata);
-    int n = drbf->npt;
-    arma::vec arma_x(n*3);
+    HermiteOpt_Workspace *ws = reinterpret_cast<HermiteOpt_Workspace*>(fdata);
+    int n = ws->n;
 
     //(  sin(a)cos(b), sin(a)sin(b), cos(a)  )  a =>[0, pi], b => [-pi, pi];
-    vector<double>sina_cosa_sinb_cosb(n * 4);
+    double *sa = ws->sina.data(), *ca = ws->cosa.data(), *sb = ws->sinb.data(), *cb = ws->cosb.data();
+    VecMath::SinCos(x.data(), 2, n, sa, ca);
+    VecMath::SinCos(x.data()+1, 2, n, sb, cb);
+
+    double *px = ws->x3.data(), *pHx = ws->Hx3.data();
     for(int i=0;i<n;++i){
-        int ind = i*4;
-        sina_cosa_sinb_cosb[ind] = sin(x[i*2]);
-        sina_cosa_sinb_cosb[ind+1] = cos(x[i*2]);
-        sina_cosa_sinb_cosb[ind+2] = sin(x[i*2+1]);
-        sina_cosa_sinb_cosb[ind+3] = cos(x[i*2+1]);
+        px[i] = sa[i] * cb[i];
+        px[i+n] = sa[i] * sb[i];
+        px[i+n*2] = ca[i];
     }
 
+    /* finalH is symmetric, only its lower triangle is streamed */
+    lapack_int n3 = n*3, inc = 1;
+    if(ws->Hop){
+        /* the sparse solve failed: stop the L-BFGS, nloptwrapper catches it */
+        if(!ws->Hop->Apply(px, pHx)){
+            ws->isfailed = true;
+            throw nlopt::forced_stop();
+        }
+    }else if(ws->H){
+        double one = 1, zero = 0;
+        dsymv_("L", &n3, &one, ws->H->memptr(), &n3, px, &inc, &zero, pHx, &inc);
+    }else if(ws->issingle){
+        float one = 1, zero = 0;
+        float *pxf = ws->x3f.data(), *pHxf = ws->Hx3f.data();
+        for(int i=0;i<n*3;++i)pxf[i] = px[i];
+        ssymv_("L", &n3, &one, ws->Hf->memptr(), &n3, pxf, &inc, &zero, pHxf, &inc);
+        for(int i=0;i<n*3;++i)pHx[i] = pHxf[i];
+    }else Symv_FloatStorage(*ws->Hf, px, pHx);
+
+    /* energy and gradient in one pass over Hx */
+    double re = 0;
+    bool isgrad = !grad.empty();
+    if(isgrad)grad.resize(n*2);
     for(int i=0;i<n;++i){
-        auto p_scsc = sina_cosa_sinb_cosb.data()+i*4;
-        //        int ind = i*3;
-        //        arma_x(ind) = p_scsc[0] * p_scsc[3];
-        //        arma_x(ind+1) = p_scsc[0] * p_scsc[2];
-        //        arma_x(ind+2) = p_scsc[1];
-        arma_x(i) = p_scsc[0] * p_scsc[3];
-        arma_x(i+n) = p_scsc[0] * p_scsc[2];
-        arma_x(i+n*2) = p_scsc[1];
+        double h0 = pHx[i], h1 = pHx[i+n], h2 = pHx[i+n*2];
+        re += px[i]*h0 + px[i+n]*h1 + px[i+n*2]*h2;
+        if(isgrad){
+            grad[i*2] = h0 * ca[i] * cb[i] + h1 * ca[i] * sb[i] - h2 * sa[i];
+            grad[i*2+1] = -h0 * sa[i] * sb[i] + h1 * sa[i] * cb[i];
+        }
     }
 
-    arma::vec a2;
-    //if(drbf->isuse_sparse)a2 = drbf->sp_H * arma_x;
-    //else
-    a2 = drbf->finalH * arma_x;
+    ws->countopt++;
 
+    ws->acc_time+=(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9);
 
-    if (!grad.empty()) {
+    //cout<<countopt++<<' '<<re<<endl;
+    return re;
 
-        grad.resize(n*2);
+}
 
-        for(int i=0;i<n;++i){
-            auto p_scsc = sina_cosa_sinb_cosb.data()+i*4;
 
-            //            int ind = i*3;
-            //            grad[i*2] = a2(ind) * p_scsc[1] * p_scsc[3] + a2(ind+1) * p_scsc[1] * p_scsc[2] - a2(ind+2) * p_scsc[0];
-            //            grad[i*2+1] = -a2(ind) * p_scsc[0] * p_scsc[2] + a2(ind+1) * p_scsc[0] * p_scsc[3];
 
-            grad[i*2] = a2(i) * p_scsc[1] * p_scsc[3] + a2(i+n) * p_scsc[1] * p_scsc[2] - a2(i+n*2) * p_scsc[0];
-            grad[i*2+1] = -a2(i) * p_scsc[0] * p_scsc[2] + a2(i+n) * p_scsc[0] * p_scsc[3];
+int RBF_Core::Opt_Hermite_PredictNormal_UnitNormal(){
 
-        }
+
+    if(isuse_sparse){
+        opt_ws.Reset(&sp_H, npt);
+        if(!Opt_Hermite_UnitNormal(initnormals, newnormals, sol, opt_ws))return 0;
+    }else if(ismixed){
+        Set_FinalH_Float();
+        Opt_Hermite_UnitNormal_Mixed(initnormals, newnormals, sol, opt_ws);
+    }else{
+        opt_ws.Reset(&finalH, npt);
+        Opt_Hermite_UnitNormal(initnormals, newnormals, sol, opt_ws);
     }
+    callfunc_time = opt_ws.acc_time;
+    solve_time = sol.time;
 
-    double re = arma::dot( arma_x, a2 );
-    countopt++;
+    arma::vec y(npt*4);
+    for(int i=0;i<npt;++i)y(i) = 0;
+    for(int i=0;i<npt;++i){
 
-    acc_time+=(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9);
+        double a = sol.solveval[i*2], b = sol.solveval[i*2+1];
+        y(npt+i) = sin(a) * cos(b);
+        y(npt+i+npt) = sin(a) * sin(b);
+        y(npt+i+npt*2) = cos(a);
+    }
 
-    //cout<<countopt++<<' '<<re<<endl;
-    return re;
+    Set_RBFCoef(y);
 
+    //sol.energy = arma::dot(a,M*a);
+    cout<<"Opt_Hermite_PredictNormal_UnitNormal"<<endl;
+    return 1;
 }
 
+/* Opt_Hermite_UnitNormal: L-BFGS over the spherical angles of the normals, starting from init;
+ * all the state of the run is in rsol and ws, so that independent runs can go concurrently */
+int RBF_Core::Opt_Hermite_UnitNormal(const vector<double>&init, vector<double>&outnormals, Solution_Struct &rsol, HermiteOpt_Workspace &ws, int maxiter){
 
 
-int RBF_Core::Opt_Hermite_PredictNormal_UnitNormal(){
-
-
-    sol.solveval.resize(npt * 2);
+    rsol.solveval.resize(npt * 2);
 
     for(int i=0;i<npt;++i){
-        double *veccc = initnormals.data()+i*3;
+        const double *veccc = init.data()+i*3;
         {
             //MyUtility::normalize(veccc);
-            sol.solveval[i*2] = atan2(sqrt(veccc[0]*veccc[0]+veccc[1]*veccc[1]),veccc[2] );
-            sol.solveval[i*2 + 1] = atan2( veccc[1], veccc[0]   );
+            rsol.solveval[i*2] = atan2(sqrt(veccc[0]*veccc[0]+veccc[1]*veccc[1]),veccc[2] );
+            rsol.solveval[i*2 + 1] = atan2( veccc[1], veccc[0]   );
         }
 
     }
@@ -463,33 +757,61 @@ int RBF_Core::Opt_Hermite_PredictNormal_UnitNormal(){
             lower[i*2 + 1] = -2 * my_PI;
         }
 
-        countopt = 0;
-        acc_time = 0;
+        ws.countopt = 0;
+        ws.acc_time = 0;
 
         //LocalIterativeSolver(sol,kk==0?normals:newnormals,300,1e-7);
-        Solver::nloptwrapper(lower,upper,optfunc_Hermite,this,1e-7,3000,sol);
-        cout<<"number of call: "<<countopt<<" t: "<<acc_time<<" ave: "<<acc_time/countopt<<endl;
-        callfunc_time = acc_time;
-        solve_time = sol.time;
+        Solver::nloptwrapper(lower,upper,optfunc_Hermite,&ws,1e-7,maxiter,rsol);
+        cout<<"number of call: "<<ws.countopt<<" t: "<<ws.acc_time<<" ave: "<<ws.acc_time/ws.countopt<<endl;
+        if(ws.isfailed){
+            cout<<"normal optimization stopped: sparse solve failed"<<endl;
+            issparsefailed = true;
+            return 0;
+        }
         //for(int i=0;i<npt;++i)cout<< sol.solveval[i]<<' ';cout<<endl;
 
     }
-    newnormals.resize(npt*3);
-    arma::vec y(npt*4);
-    for(int i=0;i<npt;++i)y(i) = 0;
+    outnormals.resize(npt*3);
     for(int i=0;i<npt;++i){
 
-        double a = sol.solveval[i*2], b = sol.solveval[i*2+1];
-        newnormals[i*3]   = y(npt+i) = sin(a) * cos(b);
-        newnormals[i*3+1] = y(npt+i+npt) = sin(a) * sin(b);
-        newnormals[i*3+2] = y(npt+i+npt*2) = cos(a);
-        MyUtility::normalize(newnormals.data()+i*3);
+        double a = rsol.solveval[i*2], b = rsol.solveval[i*2+1];
+        outnormals[i*3]   = sin(a) * cos(b);
+        outnormals[i*3+1] = sin(a) * sin(b);
+        outnormals[i*3+2] = cos(a);
+        MyUtility::normalize(outnormals.data()+i*3);
     }
 
-    Set_RBFCoef(y);
+    return 1;
+}
+
+/* Set_FinalH_Float: float copy of finalH for the mixed precision optimization, built once */
+void RBF_Core::Set_FinalH_Float(){
+
+    if(!finalH_f.is_empty())return;
+    finalH_f = arma::conv_to<arma::fmat>::from(finalH);
+}
+
+/* Opt_Hermite_UnitNormal_Mixed: the L-BFGS iterations run on the float copy of finalH, then a few
+ * iterations in double polish the result; with finalH released (lean) the polishing reads the
+ * float copy but sums in double */
+int RBF_Core::Opt_Hermite_UnitNormal_Mixed(const vector<double>&init, vector<double>&outnormals, Solution_Struct &rsol, HermiteOpt_Workspace &ws){
+
+    const int polishiter = 50;
+
+    vector<double>singlenormals;
+    ws.Reset(&finalH_f, true, npt);
+    Opt_Hermite_UnitNormal(init, singlenormals, rsol, ws);
+    double singleen = rsol.energy, singletime = ws.acc_time;
+
+    if(!finalH.is_empty())ws.Reset(&finalH, npt);
+    else ws.Reset(&finalH_f, false, npt);
+    Opt_Hermite_UnitNormal(singlenormals, outnormals, rsol, ws, polishiter);
+    ws.acc_time += singletime;
+
+    cout<<std::setprecision(10);
+    cout<<"mixed precision: float "<<singleen<<", double at the float result "<<rsol.init_energy
+       <<", polished "<<rsol.energy<<", difference "<<rsol.energy - rsol.init_energy<<endl;
 
-    //sol.energy = arma::dot(a,M*a);
-    cout<<"Opt_Hermite_PredictNormal_UnitNormal"<<endl;
     return 1;
 }
 
@@ -502,9 +824,30 @@ void RBF_Core::Set_RBFCoef(arma::vec &y){
     if(!isnewformula){
         b = bprey * y;
         a = Minv * (y - N*b);
+    }else if(isuse_sparse){
+
+        /* the solution of the regularized saddle system with zero value rows is the coefficients */
+        arma::mat r = y, ra, rb;
+        r.rows(0,npt-1).zeros();
+        if(!sp_H.Solve(r, ra, rb)){
+            cout<<"sparse solve failed, no coefficients"<<endl;
+            issparsefailed = true;
+            return;
+        }
+        a = ra.col(0);
+        b = rb.col(0);
+
     }else{
 
-        if(User_Lamnbda>0)y.subvec(0,npt-1) = -User_Lamnbda*dI*K01*y.subvec(npt,npt*4-1);
+        if(Minv.is_empty()){
+            cout<<"Minv released, skip solving the coefficients"<<endl;
+            return;
+        }
+        if(User_Lamnbda>0 && !K00_eigval.is_empty()){
+            arma::vec wy = K01_spec*y.subvec(npt,npt*4-1);
+            y.subvec(0,npt-1) = -User_Lamnbda*K00_eigvec*(wy / (1 + User_Lamnbda*K00_eigval));
+        }
+        else if(User_Lamnbda>0)y.subvec(0,npt-1) = -User_Lamnbda*dI*K01*y.subvec(npt,npt*4-1);
 
         a = Minv*y;
         b = Ninv.t()*y;
@@ -529,9 +872,15 @@ int RBF_Core::Lamnbda_Search_GlobalEigen(){
     vector<vector<double>>opt_normallist;
 
     lamnbda_list_sa = lamnbda_list;
-    for(int i=0;i<lamnbda_list.size();++i){
+    if(isconcurrentsearch && isuse_sparse)cout<<"sparse kernel: the lambda search runs sequentially, one factorization at a time"<<endl;
+    if(isconcurrentsearch && !isuse_sparse){
+        init_normallist.resize(lamnbda_list.size());
+        opt_normallist.resize(lamnbda_list.size());
+        Lamnbda_Search_Concurrent(lamnbda_list, initen_list, finalen_list, init_normallist, opt_normallist);
+    }else for(int i=0;i<lamnbda_list.size();++i){
 
         Set_HermiteApprox_Lamnda(lamnbda_list[i]);
+        if(issparsefailed)return 0;
 
         if(curMethod==Hermite_UnitNormal){
             Solve_Hermite_PredictNormal_UnitNorm();
@@ -539,6 +888,7 @@ int RBF_Core::Lamnbda_Search_GlobalEigen(){
 
         //Solve_Hermite_PredictNormal_UnitNorm();
         OptNormal(1);
+        if(issparsefailed)return 0;
 
         initen_list[i] = sol.init_energy;
         finalen_list[i] = sol.energy;
@@ -569,6 +919,65 @@ int RBF_Core::Lamnbda_Search_GlobalEigen(){
 
 
 
+/* Lamnbda_Search_Concurrent: every lambda candidate runs in its own thread with its own K,
+ * eigen init and L-BFGS workspace, the shared K blocks and finalH are only read;
+ * the threads left over are split between the candidates for the nested BLAS calls */
+void RBF_Core::Lamnbda_Search_Concurrent(vector<double>&lamnbda_list, vector<double>&initen_list, vector<double>&finalen_list,
+                                         vector<vector<double>>&init_normallist, vector<vector<double>>&opt_normallist){
+
+    int ncand = lamnbda_list.size();
+    vector<Solution_Struct>sols(ncand);
+
+    /* the shared factors are built once, before the threads start */
+    if(ismixed)Set_FinalH_Float();
+    if(isspectral)for(auto lam:lamnbda_list)if(lam>0){
+        Set_K00_Spectral();
+        break;
+    }
+
+    /* the nested BLAS calls need a second active level; both settings are put back after the search */
+    int nblas = 1, prevlevels = 1;
+#ifdef _OPENMP
+    nblas = max(1, omp_get_max_threads() / ncand);
+    prevlevels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+#endif
+    int prevblas = Blas_Set_Num_Threads(nblas);
+    cout<<"concurrent lambda search: "<<ncand<<" candidates, "<<nblas<<" BLAS threads each"<<endl;
+
+    auto t1 = Clock::now();
+#pragma omp parallel for num_threads(ncand) schedule(static,1)
+    for(int i=0;i<ncand;++i){
+#ifdef _OPENMP
+        omp_set_num_threads(nblas);
+#endif
+        Blas_Set_Num_Threads_Local(nblas);
+        double lam = max(lamnbda_list[i], 0.);
+
+        arma::mat Kc;
+        if(lam>0)Lamnda_ToMatrix(lam + User_Lamnbda, Kc);
+
+        if(curMethod==Hermite_UnitNormal)Solve_Hermite_PredictNormal_UnitNorm(lam>0 ? Kc : finalH, init_normallist[i]);
+        else init_normallist[i] = initnormals;
+        Kc.reset();
+
+        HermiteOpt_Workspace ws(&finalH, npt);
+        if(ismixed)Opt_Hermite_UnitNormal_Mixed(init_normallist[i], opt_normallist[i], sols[i], ws);
+        else Opt_Hermite_UnitNormal(init_normallist[i], opt_normallist[i], sols[i], ws);
+
+        initen_list[i] = sols[i].init_energy;
+        finalen_list[i] = sols[i].energy;
+        Blas_Set_Num_Threads_Local(0);
+    }
+    if(prevblas>0)Blas_Set_Num_Threads(prevblas);
+#ifdef _OPENMP
+    omp_set_max_active_levels(prevlevels);
+#endif
+    cout<<"concurrent lambda search: "<<(std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
+
+    sol = sols[min_element(finalen_list.begin(),finalen_list.end()) - finalen_list.begin()];
+}
+
 void RBF_Core::Print_LamnbdaSearchTest(string fname){
 
 
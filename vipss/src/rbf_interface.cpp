@@ -8,13 +8,24 @@
 #include <ctime>
 #include <chrono>
 #include<algorithm>
+#include <string.h>
 #include "ImplicitedSurfacing.h"
+#include "rbfevaluator.h"
 typedef std::chrono::high_resolution_clock Clock;
 
 void RBF_Core::BuildK(RBF_Paras para){
 
     isuse_sparse = para.isusesparse;
     sparse_para = para.sparse_para;
+    islean = para.ismemorylean;
+    isneedcoef = para.isneedcoef;
+    isspectral = para.isspectrallamnbda;
+    eigensolver = para.eigensolver;
+    kcache_dir = para.kcache_dir;
+    K00_eigval.reset();
+    K00_eigvec.reset();
+    K01_spec.reset();
+    finalH_f.reset();
     Hermite_weight_smoothness = para.Hermite_weight_smoothness;
     Hermite_designcurve_weight = para.Hermite_designcurve_weight;
 //    handcraft_sigma = para.handcraft_sigma;
@@ -46,8 +57,11 @@ void RBF_Core::BuildK(RBF_Paras para){
 void RBF_Core::InitNormal(RBF_Paras para){
 
 
+    if(issparsefailed)return;
     auto t1 = Clock::now();
     curInitMethod = para.InitMethod;
+    isconcurrentsearch = para.isconcurrentsearch;
+    ismixed = para.ismixedprecision;
     cout<<"Init Method: "<<mp_RBF_INITMETHOD[curInitMethod]<<endl;
     switch(curInitMethod){
 
@@ -62,12 +76,21 @@ void RBF_Core::InitNormal(RBF_Paras para){
     auto t2 = Clock::now();
     cout << "Init Time: " << (init_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) << endl<< endl;
 
+    if(islean)Release_InitBuffers();
+
+    /* lean mixed precision: from here on only the float copy of finalH stays resident */
+    if(islean && ismixed){
+        Set_FinalH_Float();
+        finalH.reset();
+    }
+
     mp_RBF_InitNormal[curMethod==HandCraft?0:1][curInitMethod] = initnormals;
 
 }
 
 void RBF_Core::OptNormal(int method){
 
+    if(issparsefailed)return;
     cout<<"OptNormal"<<endl;
     auto t1 = Clock::now();
 
@@ -82,26 +105,198 @@ void RBF_Core::OptNormal(int method){
     auto t2 = Clock::now();
     cout << "Opt Time: " << (solve_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) << endl<< endl;
     if(method==0)mp_RBF_OptNormal[curMethod==HandCraft?0:1][curInitMethod] = newnormals;
+
+    Mem_Checkpoint("OptNormal");
+    if(islean && method==0)Release_OptBuffers();
 }
 
 
 void RBF_Core::Surfacing(int method, int n_voxels_1d){
 
-    n_evacalls = 0;
+    Surfacing(method, vector<int>(1, n_voxels_1d), "");
+}
+
+void RBF_Core::Surfacing(int method, const vector<int> &n_voxels_1d, string fname){
+
+    if(issparsefailed)return;
     Surfacer sf;
     double re_time;
 
-    re_time = sf.Surfacing_Implicit(pts,n_voxels_1d,true,RBF_Core::Dist_Function);
-
+    RBF_Evaluator eval;
+    if(!eval.Set(*this, treecode_theta))return;
+
+    if(eval.IsTreeCode()){
+        /* error of the far-field expansions against the direct sum, on random points of the bounding box */
+        double bmin[3], bmax[3], maxerr = 0, maxval = 0, maxgerr = 0;
+        for(int k=0;k<3;++k){
+            bmin[k] = bmax[k] = pts[k];
+            for(int i=0;i<npt;++i){
+                bmin[k] = min(bmin[k], pts[i*3+k]);
+                bmax[k] = max(bmax[k], pts[i*3+k]);
+            }
+        }
+        srand(1);
+        for(int t=0;t<64;++t){
+            double x[3];
+            for(int k=0;k<3;++k)x[k] = bmin[k] + (bmax[k]-bmin[k]) * rand() / RAND_MAX;
+            double g[3], gdirect[3];
+            double direct = eval.Evaluate_Direct(x, gdirect);
+            maxerr = max(maxerr, fabs(eval.Evaluate(x, g) - direct));
+            maxval = max(maxval, fabs(direct));
+            for(int k=0;k<3;++k)maxgerr = max(maxgerr, fabs(g[k] - gdirect[k]));
+        }
+        cout<<"tree-code max error: "<<maxerr<<" (max |f| "<<maxval<<"), gradient "<<maxgerr<<endl;
+    }
 
-    sf.WriteSurface(finalMesh_v,finalMesh_fv);
+    sf.dTolerance = surf_tolerance;
+    sf.bNarrowBand = isnarrowband;
+    sf.dAdaptive = adaptive_error;
+    sf.bProgressive = n_voxels_1d.size()>1;
+    sf.iPLYFormat = ply_format;
+    re_time = 0;
+    for(size_t l=0;l<n_voxels_1d.size();++l){
+        cout<<"level "<<l<<": "<<n_voxels_1d[l]<<" voxels"<<endl;
+        string levelname = l+1<n_voxels_1d.size() ? fname+"_"+to_string(n_voxels_1d[l]) : fname;
+        /* streamed: the file is written by the surfacer, finalMesh stays empty */
+        if(isstreamsurface && !fname.empty())sf.sStreamFile = levelname;
+        re_time += sf.Surfacing_Implicit(pts,n_voxels_1d[l],true,RBF_Evaluator::Dist_Function,&eval,RBF_Evaluator::Dist_Gradient);
+        sf.WriteSurface(finalMesh_v,finalMesh_fv,finalMesh_vn);
+        if(l+1<n_voxels_1d.size() && sf.sStreamFile.empty())Write_Surface(levelname);
+    }
+    Mem_Checkpoint("Surfacing");
 
+    n_evacalls = eval.N_Calls();
     cout<<"n_evacalls: "<<n_evacalls<<"   ave: "<<re_time/n_evacalls<<endl;
 
 
 }
 
 
+void RBF_Core::Set_SurfacingParas(const RBF_Paras &para){
+
+    treecode_theta = para.treecode_theta;
+    surf_tolerance = para.surf_tolerance;
+    isnarrowband = para.isnarrowband;
+    adaptive_error = para.adaptive_error;
+    ply_format = para.ply_format;
+    isstreamsurface = para.isstreamsurface;
+}
+
+/* model file, native doubles and ints:
+ *   "VIPSSMDL", version, byte order mark 0x01020304, kernel, polynomial degree, npt, size of b,
+ *   support radius, pts (3 npt), a (4 npt: values then gradients x, y, z), b */
+static const char MODEL_MAGIC[8] = {'V','I','P','S','S','M','D','L'};
+static const int MODEL_VERSION = 1;
+static const unsigned int MODEL_BOM = 0x01020304;
+
+bool RBF_Core::Write_Model(string fname){
+
+    if(!isHermite || a.n_elem!=(arma::uword)npt*4){
+        cout<<"Write_Model: no solved Hermite coefficients"<<endl;
+        return false;
+    }
+    fname = fname + ".vipss";
+    ofstream outer(fname.data(), ofstream::out | ofstream::binary);
+    if (!outer.good()) {
+        cout << "Can not create output model file " << fname << endl;
+        return false;
+    }
+    int header[5] = {MODEL_VERSION, (int)kernal, polyDeg, npt, (int)b.n_elem};
+    double support = kernal==Wendland ? support_radius : 0;
+    outer.write(MODEL_MAGIC, sizeof(MODEL_MAGIC));
+    outer.write((const char*)&header[0], sizeof(int));
+    outer.write((const char*)&MODEL_BOM, sizeof(MODEL_BOM));
+    outer.write((const char*)&header[1], sizeof(int)*4);
+    outer.write((const char*)&support, sizeof(double));
+    outer.write((const char*)pts.data(), sizeof(double)*npt*3);
+    outer.write((const char*)a.memptr(), sizeof(double)*a.n_elem);
+    outer.write((const char*)b.memptr(), sizeof(double)*b.n_elem);
+    bool isgood = outer.good();
+    outer.close();
+    if(isgood)cout<<"saving finish: "<<fname<<endl;
+    return isgood;
+}
+
+bool RBF_Core::Read_Model(string fname, RBF_Paras para){
+
+    ifstream reader(fname.data(), ifstream::in | ifstream::binary);
+    if (!reader.good()) {
+        cout << "Can not open the model file " << fname << endl;
+        return false;
+    }else {
+        cout << "Reading: "<<fname<<endl;
+    }
+    char magic[8];
+    int version = 0, header[4];
+    unsigned int bom = 0;
+    double support;
+    reader.read(magic, sizeof(magic));
+    reader.read((char*)&version, sizeof(int));
+    reader.read((char*)&bom, sizeof(bom));
+    if(!reader.good() || memcmp(magic, MODEL_MAGIC, sizeof(magic))!=0){
+        cout << "Not a VIPSS model file: " << fname << endl;
+        return false;
+    }
+    if(version!=MODEL_VERSION || bom!=MODEL_BOM){
+        cout << "Unsupported model file (version "<<version<<", other byte order or newer): " << fname << endl;
+        return false;
+    }
+    reader.read((char*)header, sizeof(header));
+    reader.read((char*)&support, sizeof(double));
+    int n = header[2], nb = header[3];
+    if(!reader.good() || n<=0 || (nb!=0 && nb!=4 && nb!=10) || (header[0]!=XCube && header[0]!=Wendland)){
+        cout << "Corrupted model file: " << fname << endl;
+        return false;
+    }
+
+    Init((RBF_Kernal)header[0]);
+    polyDeg = header[1];
+    support_radius = support;
+    npt = n;
+    pts.resize(n*3);
+    a.set_size(n*4);
+    b.set_size(nb);
+    reader.read((char*)pts.data(), sizeof(double)*n*3);
+    reader.read((char*)a.memptr(), sizeof(double)*n*4);
+    reader.read((char*)b.memptr(), sizeof(double)*nb);
+    if(!reader.good()){
+        cout << "Truncated model file: " << fname << endl;
+        npt = 0;
+        return false;
+    }
+    isHermite = true;
+    Set_SurfacingParas(para);
+    cout<<"model: "<<npt<<" points, kernel "<<mp_RBF_Kernal[kernal]<<", polynomial degree "<<polyDeg<<endl;
+    return true;
+}
+
+bool RBF_Core::Evaluate_Points(string infname, string outfname){
+
+    vector<double>qs;
+    if(!readXYZ(infname, qs))return false;
+    RBF_Evaluator eval;
+    if(!eval.Set(*this, treecode_theta))return false;
+
+    size_t nq = qs.size()/3;
+    vector<double>vals(nq), grads(nq*3);
+    auto t1 = Clock::now();
+    eval.Evaluate(qs.data(), nq, vals.data(), grads.data());
+    auto t2 = Clock::now();
+    cout<<nq<<" queries: "<<std::chrono::nanoseconds(t2 - t1).count()/1e9<<" s"<<endl;
+
+    outfname = outfname + ".txt";
+    ofstream outer(outfname.data(), ofstream::out);
+    if (!outer.good()) {
+        cout << "Can not create output file " << outfname << endl;
+        return false;
+    }
+    outer<<setprecision(12);
+    for(size_t i=0;i<nq;++i)outer<<vals[i]<<' '<<grads[i*3]<<' '<<grads[i*3+1]<<' '<<grads[i*3+2]<<'\n';
+    outer.close();
+    cout<<"saving finish: "<<outfname<<endl;
+    return true;
+}
+
 int RBF_Core::InjectData(vector<double> &pts, RBF_Paras para){
 
     vector<int> labels;
@@ -116,6 +311,9 @@ int RBF_Core::InjectData(vector<double> &pts, vector<int> &labels, vector<double
 
     isuse_sparse = para.isusesparse;
     sparse_para = para.sparse_para;
+    islean = para.ismemorylean;
+    isneedcoef = para.isneedcoef;
+    Set_SurfacingParas(para);
     //isuse_sparse = false;
     this->pts = pts;
     this->labels = labels;
@@ -138,8 +336,6 @@ int RBF_Core::InjectData(vector<double> &pts, vector<int> &labels, vector<double
 
     SetSigma(para.sigma);
 
-    SetThis();
-
 	return 1;
 }
 
@@ -0,0 +1,131 @@
+#include "rbfcore.h"
+#include "readers.h"
+#include <armadillo>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string.h>
+#include <stdio.h>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+/* on-disk cache of the inverse of the Hermite system (-k): it only depends on the points and the kernel, so
+ * the runs on the same input with other lambdas map it in instead of assembling and inverting 4n x 4n.
+ * One file per input, named by the FNV-1a hash of the points and the kernel:
+ *   "VIPSSKC1", npt, kernel, polyDeg, 0, hash (native ints, 32 bytes so that the doubles are aligned),
+ *   pts (3 npt), Minv (4n x 4n, column major), Ninv (4n x 4) */
+
+static const char KCACHE_MAGIC[8] = {'V','I','P','S','S','K','C','1'};
+
+static unsigned long long FNV1a(const void *data, size_t size, unsigned long long h = 1469598103934665603ULL){
+
+    const unsigned char *p = (const unsigned char *)data;
+    for(size_t i=0;i<size;++i){
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+unsigned long long RBF_Core::KCache_Key(const vector<double>&pts){
+
+    int header[3] = {npt, (int)kernal, polyDeg};
+    unsigned long long h = FNV1a(header, sizeof(header));
+    return FNV1a(pts.data(), sizeof(double)*pts.size(), h);
+}
+
+string RBF_Core::KCache_File(const vector<double>&pts){
+
+    stringstream ss;
+    ss<<kcache_dir;
+    if(!kcache_dir.empty() && kcache_dir.back()!='/' && kcache_dir.back()!='\\')ss<<'/';
+    ss<<"K_"<<hex<<setw(16)<<setfill('0')<<KCache_Key(pts)<<".bin";
+    return ss.str();
+}
+
+bool RBF_Core::Read_KCache(const vector<double>&pts){
+
+    if(kcache_dir.empty())return false;
+    auto t1 = Clock::now();
+    string fname = KCache_File(pts);
+    MappedFile file;
+    if(!file.Open(fname))return false;
+
+    const size_t n4 = npt*4;
+    const size_t headsize = sizeof(KCACHE_MAGIC) + sizeof(int)*4 + sizeof(unsigned long long);
+    const size_t ptsize = sizeof(double)*npt*3;
+    if(file.size != headsize + ptsize + sizeof(double)*(n4*n4 + n4*4)){
+        cout<<"K cache: size mismatch, ignored: "<<fname<<endl;
+        return false;
+    }
+    int header[4];
+    unsigned long long key;
+    memcpy(header, file.data + sizeof(KCACHE_MAGIC), sizeof(header));
+    memcpy(&key, file.data + sizeof(KCACHE_MAGIC) + sizeof(header), sizeof(key));
+    /* the points themselves are compared, a hash collision only costs a rebuild */
+    if(memcmp(file.data, KCACHE_MAGIC, sizeof(KCACHE_MAGIC))!=0 || header[0]!=npt || header[1]!=(int)kernal ||
+            header[2]!=polyDeg || key!=KCache_Key(pts) || memcmp(file.data + headsize, pts.data(), ptsize)!=0){
+        cout<<"K cache: other input, ignored: "<<fname<<endl;
+        return false;
+    }
+
+    /* views on the mapped file, the blocks are copied straight out of it */
+    double *p_minv = (double*)(file.data + headsize + ptsize);
+    const arma::mat mappedMinv(p_minv, n4, n4, false, true);
+    const arma::mat mappedNinv(p_minv + n4*n4, n4, 4, false, true);
+    if(!islean || isneedcoef){
+        Minv = mappedMinv;
+        Ninv = mappedNinv;
+    }
+    if(!islean){
+        K = Minv;
+        K00 = K.submat(0,0,npt-1,npt-1);
+        K01 = K.submat(0,npt,npt-1,npt*4-1);
+        K11 = K.submat( npt, npt, npt*4-1, npt*4-1 );
+    }else{
+        K00 = mappedMinv.submat(0,0,npt-1,npt-1);
+        K01 = mappedMinv.submat(0,npt,npt-1,npt*4-1);
+        K11 = mappedMinv.submat( npt, npt, npt*4-1, npt*4-1 );
+    }
+
+    /* what Set_HermiteRBF leaves besides M and N */
+    isHermite = true;
+    a.set_size(npt*4);
+    bsize = 4;
+    b.set_size(4);
+    cout<<"K cache: loaded "<<fname<<" in "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<" s"<<endl;
+    Mem_Checkpoint("BuildK");
+    return true;
+}
+
+bool RBF_Core::Write_KCache(const vector<double>&pts, const arma::mat &bigMinv){
+
+    if(kcache_dir.empty())return false;
+    string fname = KCache_File(pts);
+    /* written aside and renamed, so that a concurrent run never maps a partial file */
+    string tmpname = fname + ".tmp" + to_string((long long)Clock::now().time_since_epoch().count());
+    ofstream outer(tmpname.data(), ofstream::out | ofstream::binary);
+    if (!outer.good()) {
+        cout << "K cache: can not create " << tmpname << endl;
+        return false;
+    }
+    const size_t n4 = npt*4;
+    int header[4] = {npt, (int)kernal, polyDeg, 0};
+    unsigned long long key = KCache_Key(pts);
+    outer.write(KCACHE_MAGIC, sizeof(KCACHE_MAGIC));
+    outer.write((const char*)header, sizeof(header));
+    outer.write((const char*)&key, sizeof(key));
+    outer.write((const char*)pts.data(), sizeof(double)*npt*3);
+    /* the Minv and Ninv blocks of the columns of bigMinv */
+    for(size_t j=0;j<n4+4;++j)outer.write((const char*)bigMinv.colptr(j), sizeof(double)*n4);
+    bool isgood = outer.good();
+    outer.close();
+    if(!isgood || rename(tmpname.data(), fname.data())!=0){
+        cout << "K cache: can not write " << fname << endl;
+        remove(tmpname.data());
+        return false;
+    }
+    cout<<"K cache: saved "<<fname<<endl;
+    return true;
+}
@@ -0,0 +1,201 @@
+#include "rbfcore.h"
+#include "utility.h"
+#include "Solver.h"
+#include <armadillo>
+#include <chrono>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+typedef std::chrono::high_resolution_clock Clock;
+
+/* sparse pipeline for the compactly supported kernels: the Hermite matrix M only couples the points
+ * closer than the support, it is assembled from a grid neighbor search, factorized once per lambda,
+ * and K is only ever applied through SparseHermite_Operator */
+
+
+void RBF_Core::Set_PointGrid(double cell){
+
+    grid.Build(pts, cell);
+    cout<<"point grid: "<<grid.cells.size()<<" cells"<<endl;
+}
+
+
+/* Set_HermiteRBF_Sparse: same entries and layout as Assemble_HermiteRBF, only for the pairs within the support;
+ * each pair (i<j) is evaluated once by the thread owning i and written to both triangles */
+void RBF_Core::Set_HermiteRBF_Sparse(vector<double>&pts){
+
+    cout<<"Set_HermiteRBF_Sparse"<<endl;
+    isHermite = true;
+    auto t0 = Clock::now();
+
+    const int n = npt;
+    const double *p_pts = pts.data();
+    const double s2 = support_radius * support_radius;
+
+    int nthread = 1;
+#ifdef _OPENMP
+    nthread = omp_get_max_threads();
+#endif
+    vector<vector<arma::uword>>locs(nthread);
+    vector<vector<double>>vals(nthread);
+
+#pragma omp parallel
+    {
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+        vector<arma::uword>&loc = locs[tid];
+        vector<double>&val = vals[tid];
+        auto push = [&](arma::uword r, arma::uword c, double v){
+            if(v==0)return;
+            loc.push_back(r);
+            loc.push_back(c);
+            val.push_back(v);
+        };
+        double v, G[3], H[9];
+
+#pragma omp for schedule(dynamic,64)
+        for(int i=0;i<n;++i){
+            const double *p_i = p_pts+i*3;
+
+            /* diagonal: the gradient vanishes, the Hessian is diagonal */
+            Kernal_Fused_Function_2p(p_i, p_i, &v, G, H);
+            push(i, i, v);
+            for(int k=0;k<3;++k)push(n+i+k*n, n+i+k*n, -H[k*4]);
+
+            grid.Visit(p_i, [&](int j){
+                if(j<=i || MyUtility::vecSquareDist(p_i, p_pts+j*3)>=s2)return;
+                Kernal_Fused_Function_2p(p_i, p_pts+j*3, &v, G, H);
+
+                push(i, j, v);
+                push(j, i, v);
+                for(int k=0;k<3;++k){
+                    const arma::uword ci = n+i+k*n, cj = n+j+k*n;
+                    push(i, cj, G[k]);
+                    push(cj, i, G[k]);
+                    push(j, ci, -G[k]);
+                    push(ci, j, -G[k]);
+                }
+                for(int k=0;k<3;++k)
+                    for(int l=0;l<3;++l){
+                        const arma::uword ci = n+i+k*n, cj = n+j+l*n;
+                        push(ci, cj, -H[k*3+l]);
+                        push(cj, ci, -H[k*3+l]);
+                    }
+            });
+        }
+    }
+
+    size_t nnz = 0;
+    for(auto &val:vals)nnz += val.size();
+    arma::umat locations(2, nnz);
+    arma::vec values(nnz);
+    size_t ind = 0;
+    for(int t=0;t<nthread;++t){
+        for(size_t k=0;k<vals[t].size();++k,++ind){
+            locations(0,ind) = locs[t][k*2];
+            locations(1,ind) = locs[t][k*2+1];
+            values(ind) = vals[t][k];
+        }
+        vector<arma::uword>().swap(locs[t]);
+        vector<double>().swap(vals[t]);
+    }
+    sp_M = arma::sp_mat(locations, values, n*4, n*4);
+
+    cout<<"assemble sparse M: "<<std::chrono::nanoseconds(Clock::now() - t0).count()/1e9
+       <<", nnz "<<sp_M.n_nonzero<<" ("<<double(sp_M.n_nonzero)/(n*4)<<" per row)"<<endl;
+
+    bsize= 4;
+    N.zeros(npt*4,4);
+    b.set_size(4);
+    a.set_size(npt*4);
+    for(int i=0;i<npt;++i){
+        N(i,0) = 1;
+        for(int j=0;j<3;++j)N(i,j+1) = pts[i*3+j];
+    }
+    for(int i=0;i<npt;++i)
+        for(int j=0;j<3;++j)N(npt+i+j*npt,j+1) = -1;
+}
+
+
+void RBF_Core::Set_Hermite_PredictNormal_Sparse(vector<double>&pts){
+
+    auto t1 = Clock::now();
+
+    double bmin[3], bmax[3];
+    for(int k=0;k<3;++k){
+        bmin[k] = bmax[k] = pts[k];
+        for(int i=0;i<npt;++i){
+            bmin[k] = min(bmin[k], pts[i*3+k]);
+            bmax[k] = max(bmax[k], pts[i*3+k]);
+        }
+    }
+    double diag = sqrt(pow(bmax[0]-bmin[0],2) + pow(bmax[1]-bmin[1],2) + pow(bmax[2]-bmin[2],2));
+    support_radius = sparse_para * diag;
+    SetSupport(support_radius);
+    cout<<"kernel support: "<<support_radius<<endl;
+
+    Set_PointGrid(support_radius);
+    Set_HermiteRBF_Sparse(pts);
+    Mem_Checkpoint("BuildK");
+
+    sp_K.Clear();
+    if(!sp_H.Set(sp_M, N, User_Lamnbda)){
+        cout<<"sparse factorization failed"<<endl;
+        issparsefailed = true;
+    }
+    Mem_Checkpoint("BuildK");
+
+    cout<<"solve K total: "<<(setK_time= std::chrono::nanoseconds(Clock::now() - t1).count()/1e9)<<endl;
+}
+
+
+/* Solve_Hermite_PredictNormal_Sparse: smallest eigenvector of the K operator by LOBPCG,
+ * every product with K is a pair of sparse triangular solves */
+int RBF_Core::Solve_Hermite_PredictNormal_Sparse(SparseHermite_Operator &Kop, vector<double>&outnormals){
+
+    auto t1 = Clock::now();
+    double eigval = 0;
+    arma::vec eigvec;
+    bool isapplied = true;
+    auto op = [&](const arma::mat &X, arma::mat &Y){ return isapplied = Kop.Apply(X, Y); };
+    if(!Solver::LOBPCG_Smallest(op, npt*3, 4, 1e-6, 500, eigval, eigvec)){
+        if(!isapplied){
+            cout<<"sparse eigen: sparse solve failed"<<endl;
+            issparsefailed = true;
+            return 0;
+        }
+        cout<<"sparse eigen: LOBPCG not converged"<<endl;
+    }
+    cout<<"eigval(0): "<<eigval<<", sparse eigen: "<<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+
+    outnormals.resize(npt*3);
+    for(int i=0;i<npt;++i)
+        for(int k=0;k<3;++k)outnormals[i*3+k] = eigvec(i+k*npt);
+
+    return 1;
+}
+
+
+/* Dist_Function_Sparse: only the points within the support of p contribute */
+double RBF_Core::Dist_Function_Sparse(const double *p){
+
+    const double *p_pts = pts.data();
+    const double s2 = support_radius * support_radius;
+    double re = 0;
+    grid.Visit(p, [&](int i){
+        const double *p_i = p_pts+i*3;
+        if(MyUtility::vecSquareDist(p_i, p)>=s2)return;
+        double G[3];
+        Kernal_Gradient_Function_2p(p, p_i, G);
+        re += a(i) * Kernal_Function_2p(p_i, p);
+        for(int j=0;j<3;++j)re += a(npt+i+j*npt) * G[j];
+    });
+
+    re += b(0);
+    for(int j=0;j<3;++j)re += b(j+1) * p[j];
+    return re;
+}
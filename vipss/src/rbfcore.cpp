@@ -8,6 +8,7 @@
 #include <ctime>
 #include <chrono>
 #include<algorithm>
+#include<cstring>
 
 
 
@@ -100,6 +101,27 @@ void XCube_Hessian_Kernel_2p(const double *p1, const double *p2, double *H){
 
 }
 
+void XCube_Fused_Kernel_2p(const double *p1, const double *p2, double *v, double *G, double *H){
+
+
+    double diff[3];
+    for(int i=0;i<3;++i)diff[i] = p1[i] - p2[i];
+    double len_dist  = sqrt(MyUtility::len(diff));
+
+    *v = len_dist*len_dist*len_dist;
+    for(int i=0;i<3;++i)G[i] = 3*len_dist*diff[i];
+
+    if(len_dist<1e-8){
+        for(int i=0;i<9;++i)H[i] = 0;
+    }else{
+        double inv_len = 3 / len_dist;
+        for(int i=0;i<3;++i)for(int j=0;j<3;++j)
+            H[i*3+j] = inv_len * diff[i] * diff[j];
+        for(int i=0;i<3;++i)H[i*4] += 3 * len_dist;
+    }
+
+}
+
 void XCube_HessianDot_Kernel_2p(const double *p1, const double *p2, const double *p3, vector<double>&dotout){
 
 
@@ -115,11 +137,97 @@ void XCube_HessianDot_Kernel_2p(const double *p1, const double *p2, const double
 
 }
 
+/* Wendland C4, compactly supported on r < wendland_support:
+ * phi(r) = (1-t)^6 (35t^2+18t+3), t = r/support; positive definite in 3D, so the Hermite matrix is SPD and sparse */
+double wendland_support = 1.0;
+double inv_wendland_support = 1.0;
+double Wendland_Kernel(const double x){
+
+    double t = x * inv_wendland_support;
+    if(t>=1)return 0;
+    double t1 = 1-t, t2 = t1*t1;
+    return t2*t2*t2*(35*t*t+18*t+3);
+}
+
+double Wendland_Kernel_2p(const double *p1, const double *p2){
+
+
+    return Wendland_Kernel(MyUtility::_VerticesDistance(p1,p2));
+
+}
+
+void Wendland_Gradient_Kernel_2p(const double *p1, const double *p2, double *G){
+
+
+    double len_dist  = MyUtility::_VerticesDistance(p1,p2);
+    double t = len_dist * inv_wendland_support;
+    if(t>=1){
+        for(int i=0;i<3;++i)G[i] = 0;
+        return;
+    }
+    double t1 = 1-t, t5 = t1*t1*t1*t1*t1;
+    double dphi_r = -56 * (5*t+1) * t5 * inv_wendland_support * inv_wendland_support;
+    for(int i=0;i<3;++i)G[i] = dphi_r*(p1[i]-p2[i]);
+    return;
+
+}
+
+void Wendland_Hessian_Kernel_2p(const double *p1, const double *p2, double *H){
+
+
+    double diff[3];
+    for(int i=0;i<3;++i)diff[i] = p1[i] - p2[i];
+    double len_dist  = sqrt(MyUtility::len(diff));
+    double t = len_dist * inv_wendland_support;
+
+    if(t>=1){
+        for(int i=0;i<9;++i)H[i] = 0;
+    }else{
+        double is2 = inv_wendland_support * inv_wendland_support;
+        double t1 = 1-t, t4 = t1*t1*t1*t1;
+        double dd = 1680 * t4 * is2 * is2;
+        double dphi_r = -56 * (5*t+1) * t4 * t1 * is2;
+        for(int i=0;i<3;++i)for(int j=0;j<3;++j)
+            H[i*3+j] = dd * diff[i] * diff[j];
+        for(int i=0;i<3;++i)H[i*4] += dphi_r;
+    }
+
+    return;
+
+}
+
+void Wendland_Fused_Kernel_2p(const double *p1, const double *p2, double *v, double *G, double *H){
+
+
+    double diff[3];
+    for(int i=0;i<3;++i)diff[i] = p1[i] - p2[i];
+    double len_dist  = sqrt(MyUtility::len(diff));
+    double t = len_dist * inv_wendland_support;
+
+    if(t>=1){
+        *v = 0;
+        for(int i=0;i<3;++i)G[i] = 0;
+        for(int i=0;i<9;++i)H[i] = 0;
+    }else{
+        double is2 = inv_wendland_support * inv_wendland_support;
+        double t1 = 1-t, t4 = t1*t1*t1*t1;
+        double dd = 1680 * t4 * is2 * is2;
+        double dphi_r = -56 * (5*t+1) * t4 * t1 * is2;
+        *v = t4 * t1 * t1 * (35*t*t+18*t+3);
+        for(int i=0;i<3;++i)G[i] = dphi_r*diff[i];
+        for(int i=0;i<3;++i)for(int j=0;j<3;++j)
+            H[i*3+j] = dd * diff[i] * diff[j];
+        for(int i=0;i<3;++i)H[i*4] += dphi_r;
+    }
+
+}
+
 RBF_Core::RBF_Core(){
 
     Kernal_Function = Gaussian_Kernel;
     Kernal_Function_2p = Gaussian_Kernel_2p;
     P_Function_2p = Gaussian_PKernel_Dirichlet_2p;
+    Kernal_Fused_Function_2p = NULL;
 
     isHermite = false;
 
@@ -150,10 +258,12 @@ RBF_Core::RBF_Core(){
     mp_RBF_Kernal.insert(make_pair(ThinSpline,"ThinSpline"));
     mp_RBF_Kernal.insert(make_pair(XLinear,"XLinear"));
     mp_RBF_Kernal.insert(make_pair(Gaussian,"Gaussian"));
+    mp_RBF_Kernal.insert(make_pair(Wendland,"Wendland"));
 
 }
 RBF_Core::RBF_Core(RBF_Kernal kernal){
     isHermite = false;
+    Kernal_Fused_Function_2p = NULL;
     Init(kernal);
 }
 
@@ -165,6 +275,7 @@ void RBF_Core::Init(RBF_Kernal kernal){
         Kernal_Function = Gaussian_Kernel;
         Kernal_Function_2p = Gaussian_Kernel_2p;
         P_Function_2p = Gaussian_PKernel_Dirichlet_2p;
+        Kernal_Fused_Function_2p = NULL;
         break;
 
     case XCube:
@@ -172,6 +283,15 @@ void RBF_Core::Init(RBF_Kernal kernal){
         Kernal_Function_2p = XCube_Kernel_2p;
         Kernal_Gradient_Function_2p = XCube_Gradient_Kernel_2p;
         Kernal_Hessian_Function_2p = XCube_Hessian_Kernel_2p;
+        Kernal_Fused_Function_2p = XCube_Fused_Kernel_2p;
+        break;
+
+    case Wendland:
+        Kernal_Function = Wendland_Kernel;
+        Kernal_Function_2p = Wendland_Kernel_2p;
+        Kernal_Gradient_Function_2p = Wendland_Gradient_Kernel_2p;
+        Kernal_Hessian_Function_2p = Wendland_Hessian_Kernel_2p;
+        Kernal_Fused_Function_2p = Wendland_Fused_Kernel_2p;
         break;
 
     default:
@@ -186,6 +306,11 @@ void RBF_Core::SetSigma(double x){
     inv_sigma_squarex2 = 1/(2 * pow(sigma, 2));
 }
 
+void RBF_Core::SetSupport(double x){
+    wendland_support = x;
+    inv_wendland_support = 1/x;
+}
+
 double RBF_Core::Dist_Function(const double x, const double y, const double z){
 
 
@@ -199,42 +324,26 @@ double RBF_Core::Dist_Function(const double *p){
 
     n_evacalls++;
     double *p_pts = pts.data();
-    static arma::vec kern(npt), kb;
+    if(isuse_sparse && isHermite)return Dist_Function_Sparse(p);
+
+    double loc_part = 0;
+    for(int i=0;i<npt;++i)loc_part += a(i) * Kernal_Function_2p(p_pts+i*3, p);
     if(isHermite){
-        kern.set_size(npt*4);
         double G[3];
-        for(int i=0;i<npt;++i)kern(i) = Kernal_Function_2p(p_pts+i*3, p);
         for(int i=0;i<npt;++i){
             Kernal_Gradient_Function_2p(p,p_pts+i*3,G);
-            //for(int j=0;j<3;++j)kern(npt+i*3+j) = -G[j];
-            for(int j=0;j<3;++j)kern(npt+i+j*npt) = G[j];
+            for(int j=0;j<3;++j)loc_part += a(npt+i+j*npt) * G[j];
         }
-    }else{
-        kern.set_size(npt);
-        for(int i=0;i<npt;++i)kern(i) = Kernal_Function_2p(p_pts+i*3, p);
     }
 
-    double loc_part = dot(kern,a);
-
+    double poly_part = 0;
     if(polyDeg==1){
-        kb.set_size(4);
-        for(int i=0;i<3;++i)kb(i+1) = p[i];
-        kb(0) = 1;
+        poly_part = b(0);
+        for(int i=0;i<3;++i)poly_part += b(i+1) * p[i];
     }else if(polyDeg==2){
-        vector<double>buf(4,1);
+        double buf[4] = {1, p[0], p[1], p[2]};
         int ind = 0;
-        kb.set_size(10);
-        for(int j=0;j<3;++j)buf[j+1] = p[j];
-        for(int j=0;j<4;++j)for(int k=j;k<4;++k)kb(ind++) = buf[j] * buf[k];
-    }
-    double poly_part = dot(kb,b);
-
-    if(0){
-        cout<<"dist: "<<p[0]<<' '<<p[1]<<' '<<p[2]<<' '<<p_pts[3]<<' '<<p_pts[4]<<' '<<p_pts[5]<<' '<<
-              Kernal_Function_2p(p,p_pts+3)<<endl;
-        for(int i=0;i<npt;++i)cout<<kern(i)<<' ';
-        for(int i=0;i<bsize;++i)cout<<kb(i)<<' ';
-        cout<<endl;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k)poly_part += b(ind++) * buf[j] * buf[k];
     }
 
     double re = loc_part + poly_part;
@@ -242,26 +351,13 @@ double RBF_Core::Dist_Function(const double *p){
 
 
 }
-static RBF_Core * s_hrbf;
-double RBF_Core::Dist_Function(const R3Pt &in_pt){
-    return s_hrbf->Dist_Function(&(in_pt[0]));
-}
-
-//FT RBF_Core::Dist_Function(const Point_3 in_pt){
-
-//    return s_hrbf->Dist_Function(&(in_pt.x()));
-//}
-
-void RBF_Core::SetThis(){
-
-    s_hrbf = this;
-}
 
 void RBF_Core::Write_Surface(string fname){
 
     //writeObjFile(fname,finalMesh_v,finalMesh_fv);
 
-    writePLYFile_VF(fname,finalMesh_v,finalMesh_fv);
+    if(finalMesh_vn.size()==finalMesh_v.size())writePLYFile_VFN(fname,finalMesh_v,finalMesh_fv,finalMesh_vn,ply_format);
+    else writePLYFile_VF(fname,finalMesh_v,finalMesh_fv,ply_format);
 }
 
 /**********************************************************/
@@ -369,3 +465,88 @@ void RBF_Core::Clear_TimerRecord(){
     setK_timev.clear();
 
 }
+
+
+/**********************************************************/
+
+size_t RBF_Core::MatrixBytes(){
+
+    const arma::mat *mats[] = {&M, &N, &Minv, &P, &K, &bprey, &saveK, &saveK_finalH, &finalH, &RQ,
+                               &bigM, &bigMinv, &Ninv, &K00, &K01, &K11, &dI, &K00_eigvec, &K01_spec};
+    size_t re = (a.n_elem + b.n_elem + K00_eigval.n_elem) * sizeof(double) + finalH_f.n_elem * sizeof(float);
+    for(auto pm:mats)re += pm->n_elem * sizeof(double);
+    re += sp_M.n_nonzero * (sizeof(double) + sizeof(arma::uword));
+    return re;
+}
+
+/* process resident high-water mark (VmHWM), 0 if not available */
+static size_t ProcessPeakBytes(){
+
+    size_t re = 0;
+    ifstream fin("/proc/self/status");
+    string line;
+    while(getline(fin,line)){
+        if(line.compare(0,6,"VmHWM:")==0){
+            re = strtoull(line.c_str()+6, NULL, 10) * 1024;
+            break;
+        }
+    }
+    return re;
+}
+
+void RBF_Core::Mem_Checkpoint(string stage){
+
+    size_t cur = MatrixBytes();
+    auto it = find(mem_stage.begin(),mem_stage.end(),stage);
+    if(it==mem_stage.end()){
+        mem_stage.push_back(stage);
+        mem_stage_peak.push_back(cur);
+    }else{
+        size_t &peak = mem_stage_peak[it-mem_stage.begin()];
+        peak = max(peak,cur);
+    }
+}
+
+void RBF_Core::Release_InitBuffers(){
+
+    K.reset();
+    K00.reset();
+    K11.reset();
+    saveK.reset();
+    saveK_finalH.reset();
+    sp_K.Clear();
+    if(!isneedcoef || User_Lamnbda<=0){
+        K01.reset();
+        dI.reset();
+        K00_eigval.reset();
+        K00_eigvec.reset();
+        K01_spec.reset();
+    }
+}
+
+void RBF_Core::Release_OptBuffers(){
+
+    finalH.reset();
+    Minv.reset();
+    Ninv.reset();
+    K01.reset();
+    dI.reset();
+    K00_eigval.reset();
+    K00_eigvec.reset();
+    K01_spec.reset();
+    finalH_f.reset();
+    opt_ws = HermiteOpt_Workspace();
+    sp_M.reset();
+    sp_H.Clear();
+}
+
+void RBF_Core::Print_MemRecord(){
+
+    cout<<setprecision(4);
+    cout<<"Peak matrix memory per stage (MB):"<<endl;
+    for(int i=0;i<mem_stage.size();++i){
+        cout<<mem_stage[i]<<string(max(1,16-int(mem_stage[i].size())),' ')<<mem_stage_peak[i]/1048576.<<endl;
+    }
+    size_t hwm = ProcessPeakBytes();
+    if(hwm)cout<<"Process high-water mark (MB): "<<hwm/1048576.<<endl;
+}
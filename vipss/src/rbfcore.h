@@ -8,6 +8,8 @@
 #include <vector>
 #include "Solver.h"
 #include "ImplicitedSurfacing.h"
+#include "sparsesolver.h"
+#include "pointgrid.h"
 //#include "eigen3/Eigen/Dense"
 #include <armadillo>
 #include <unordered_map>
@@ -55,11 +57,18 @@ enum RBF_InitMethod{
     RBF_Init_EMPTY
 };
 
+enum RBF_EigenSolver{
+    EIG_FULL,
+    EIG_LOBPCG,
+    EIG_SHIFTINVERT
+};
+
 enum RBF_Kernal{
     XCube,
     ThinSpline,
     XLinear,
     Gaussian,
+    Wendland,
 };
 
 class RBF_Paras{
@@ -73,6 +82,19 @@ public:
     double user_lamnbda;
     double rangevalue;
     double sparse_para = 1e-3;
+    bool ismemorylean = false;
+    bool isspectrallamnbda = true;
+    RBF_EigenSolver eigensolver = EIG_LOBPCG;
+    bool isconcurrentsearch = false;
+    bool ismixedprecision = false;
+    double treecode_theta = 0;
+    double surf_tolerance = 0;
+    bool isnarrowband = false;
+    double adaptive_error = 0;
+    int ply_format = PLY_ASCII;
+    bool isstreamsurface = false;
+    string kcache_dir;
+    bool isneedcoef = true;
     double Hermite_weight_smoothness;
     double Hermite_ls_weight;
     double Hermite_designcurve_weight;
@@ -87,6 +109,30 @@ public:
 
 
 
+/* state of one normal optimization run, passed to nlopt as the function data
+ * the buffers are sized once in Reset, so that the objective does not allocate
+ * the matrix is H in double, or Hf in float with issingle: float product, otherwise float storage with double sums;
+ * Hop (sparse pipeline) replaces the matrix by the K operator of the factorized Hermite system */
+class HermiteOpt_Workspace{
+public:
+    SparseHermite_Operator *Hop;
+    const arma::mat *H;
+    const arma::fmat *Hf;
+    bool issingle;
+    bool isfailed;              // the sparse solve of an evaluation failed
+    int n;
+    int countopt;
+    double acc_time;
+    vector<double>sina, cosa, sinb, cosb;
+    vector<double>x3, Hx3;
+    vector<float>x3f, Hx3f;
+    HermiteOpt_Workspace():Hop(NULL),H(NULL),Hf(NULL),issingle(false),isfailed(false),n(0),countopt(0),acc_time(0){}
+    HermiteOpt_Workspace(const arma::mat *H, int n){Reset(H,n);}
+    void Reset(const arma::mat *H, int n);
+    void Reset(const arma::fmat *Hf, bool issingle, int n);
+    void Reset(SparseHermite_Operator *Hop, int n);
+};
+
 class RBF_Core{
 
 public:
@@ -98,6 +144,7 @@ public:
     int bsize;
 
     bool isinv = true;
+    bool isldlt = true;
     bool isnewformula = true;
     double User_Lamnbda;
 
@@ -131,6 +178,7 @@ public:
 public:
     vector<double>finalMesh_v;
     vector<uint>finalMesh_fv;
+    vector<double>finalMesh_vn;
 
 public:
 
@@ -158,10 +206,56 @@ public:
     arma::mat K11;
     arma::mat dI;
 
+    bool isspectral = true;
+    RBF_EigenSolver eigensolver = EIG_LOBPCG;
+    bool isconcurrentsearch = false;
+    bool ismixed = false;
+    arma::fmat finalH_f;
+    arma::vec K00_eigval;
+    arma::mat K00_eigvec;
+    arma::mat K01_spec;
+
 
     bool isuse_sparse = false;
     double sparse_para = 1e-3;
 
+    /* sparse pipeline: sparse_para is the kernel support relative to the bounding box diagonal
+     * sp_H is the operator of finalH, sp_K the one of the current lambda candidate */
+    double support_radius;
+    arma::sp_mat sp_M;
+    SparseHermite_Operator sp_H;
+    SparseHermite_Operator sp_K;
+    /* a sparse factorization or solve failed (e.g. CG not converged): the later stages are skipped */
+    bool issparsefailed = false;
+
+    /* grid of cell size support_radius over pts, for the neighbor searches */
+    PointGrid grid;
+
+    /* tree-code evaluation of the XCube implicit function for the surfacing, off if treecode_theta <= 0 */
+    double treecode_theta = 0;
+
+    /* vertex accuracy of the surfacing relative to the voxel size, root refinement along the edges
+     * with the analytic gradient; fixed bisection if surf_tolerance <= 0 */
+    double surf_tolerance = 0;
+
+    /* surfacing on the narrow band of voxels around the input points, see polygonize_band */
+    bool isnarrowband = false;
+
+    /* adaptive octree surfacing, distance error relative to the voxel size; uniform if <= 0 */
+    double adaptive_error = 0;
+
+    /* encoding of the PLY files written, see PLYFormat */
+    int ply_format = PLY_ASCII;
+
+    /* the surface is streamed to its file by the polygonizer, see Surfacing(method, n_voxels_1d, fname) */
+    bool isstreamsurface = false;
+
+    /* directory of the cache of the inverse Hermite system, no cache if empty */
+    string kcache_dir;
+
+    bool islean = false;
+    bool isneedcoef = true;
+
 public:
     unordered_map<int, string>mp_RBF_INITMETHOD;
     unordered_map<int, string>mp_RBF_METHOD;
@@ -186,6 +280,7 @@ public:
     double ls_coef;
     void (*Kernal_Gradient_Function_2p)(const double *p1, const double *p2, double *G);
     void (*Kernal_Hessian_Function_2p)(const double *p1, const double *p2, double *H);
+    void (*Kernal_Fused_Function_2p)(const double *p1, const double *p2, double *v, double *G, double *H);
 
 private:
     vector<double>local_eigenBe, local_eigenEd, eigenBe, eigenEd, gtBe, gtEd;
@@ -208,16 +303,18 @@ public:
 
     double Dist_Function(const double x, const double y, const double z);
     double Dist_Function(const double *p);
+    double Dist_Function_Sparse(const double *p);
 
 public:
-    static double Dist_Function(const R3Pt &in_pt);
-    //static FT Dist_Function(const Point_3 in_pt);
     int n_evacalls;
 public:
-    void SetThis();
-public:
 
     void SetSigma(double x);
+    void SetSupport(double x);
+
+public:
+
+    void Set_PointGrid(double cell);
 
 
 public:
@@ -229,17 +326,31 @@ public:
 
 public:
     void Set_HermiteRBF(vector<double>&pts);
+    void Assemble_HermiteRBF(const double *p_pts);
     int Solve_HermiteRBF(vector<double>&vn);
 
 public:
     void Set_Hermite_PredictNormal(vector<double>&pts);
+    /* cache of Minv, Ninv in kcache_dir, see rbf_kcache.cpp; Read_KCache sets Minv, Ninv, K, K00, K01, K11
+     * as Set_Hermite_PredictNormal does, and returns false if there is no entry for pts */
+    bool Read_KCache(const vector<double>&pts);
+    bool Write_KCache(const vector<double>&pts, const arma::mat &bigMinv);
+    unsigned long long KCache_Key(const vector<double>&pts);
+    string KCache_File(const vector<double>&pts);
+    void Set_HermiteRBF_Sparse(vector<double>&pts);
+    void Set_Hermite_PredictNormal_Sparse(vector<double>&pts);
+    int Solve_Hermite_PredictNormal_Sparse(SparseHermite_Operator &Kop, vector<double>&outnormals);
 
 public:
 
     int Solve_Hermite_PredictNormal_UnitNorm();
+    int Solve_Hermite_PredictNormal_UnitNorm(const arma::mat &Kr, vector<double>&outnormals);
+    bool Solve_SmallestEigen(const arma::mat &A, double &eigval, arma::vec &eigvec);
 
 
     int Lamnbda_Search_GlobalEigen();
+    void Lamnbda_Search_Concurrent(vector<double>&lamnbda_list, vector<double>&initen_list, vector<double>&finalen_list,
+                                   vector<vector<double>>&init_normallist, vector<vector<double>>&opt_normallist);
 
 
 public:
@@ -261,6 +372,10 @@ public:
     void Set_Actual_User_LSCoef(double user_ls);
     void Set_User_Lamnda_ToMatrix(double user_ls);
 
+    void Set_K00_Spectral();
+    void Spectral_Lamnda_ToMatrix(double lamnbda, arma::mat &outK);
+    void Lamnda_ToMatrix(double lamnbda, arma::mat &outK);
+
     void Set_SparsePara(double spa);
 
 
@@ -278,7 +393,11 @@ public:
 
 public:
 
+    HermiteOpt_Workspace opt_ws;
     int Opt_Hermite_PredictNormal_UnitNormal();
+    int Opt_Hermite_UnitNormal(const vector<double>&init, vector<double>&outnormals, Solution_Struct &rsol, HermiteOpt_Workspace &ws, int maxiter = 3000);
+    int Opt_Hermite_UnitNormal_Mixed(const vector<double>&init, vector<double>&outnormals, Solution_Struct &rsol, HermiteOpt_Workspace &ws);
+    void Set_FinalH_Float();
 
 public:
 
@@ -288,6 +407,7 @@ public:
     int InjectData(vector<double> &pts, vector<int> &labels, vector<double> &normals, vector<double> &tangents, vector<uint> &edges, RBF_Paras para);
 
     int InjectData(vector<double> &pts, RBF_Paras para);
+    void Set_SurfacingParas(const RBF_Paras &para);
 
     void BuildK(RBF_Paras para);
 
@@ -297,6 +417,19 @@ public:
 
     void Surfacing(int method, int n_voxels_1d);
 
+    /* the solved function (points, coefficients a, b, kernel, polynomial degree) to fname.vipss, and back
+     * with the surfacing options of para: Surfacing and Evaluate_Points then run without solving */
+    bool Write_Model(string fname);
+    bool Read_Model(string fname, RBF_Paras para);
+    /* value and gradient of the function at the points of the .xyz file infname, "f gx gy gz" per line
+     * in outfname.txt */
+    bool Evaluate_Points(string infname, string outfname);
+    /* coarse to fine, one surface per resolution of n_voxels_1d (growing): the corner values of a level
+     * are reused by the next when it is a multiple of it; every level but the last is written to
+     * fname_<n_voxels> as a preview, the last one is the final mesh; with isstreamsurface, every level
+     * is streamed to its file while surfacing and the final mesh is fname, not kept in memory */
+    void Surfacing(int method, const vector<int> &n_voxels_1d, string fname);
+
     void BuildCoherentGraph();
 
     void BatchInitEnergyTest(vector<double> &pts, vector<int> &labels, vector<double> &normals, vector<double> &tangents, vector<uint> &edges, RBF_Paras para);
@@ -339,6 +472,16 @@ public:
     void Clear_TimerRecord();
     void Print_Record_Init();
 
+public:
+    vector<string>mem_stage;
+    vector<size_t>mem_stage_peak;
+
+    size_t MatrixBytes();
+    void Mem_Checkpoint(string stage);
+    void Release_InitBuffers();
+    void Release_OptBuffers();
+    void Print_MemRecord();
+
 };
 
 
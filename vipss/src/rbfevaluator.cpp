@@ -0,0 +1,197 @@
+#include "rbfevaluator.h"
+#include <cmath>
+#include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+/* radial part of the kernels: phi, psi = phi'(r)/r and chi = psi'(r)/r, so that at d = x - p_i
+ * grad phi = psi d and Hess phi = psi I + chi d d^T
+ * no branch on the point data, only selects, so that the kernel sums below vectorize */
+struct XCube_Radial{
+    inline void operator()(double r, double &phi, double &psi, double &chi) const{
+        phi = r*r*r;
+        psi = 3*r;
+        chi = r>1e-8 ? 3/r : 0;
+    }
+};
+
+struct Wendland_Radial{
+    double is, is2;
+    Wendland_Radial(double support):is(1/support),is2(1/(support*support)){}
+    inline void operator()(double r, double &phi, double &psi, double &chi) const{
+        double t = r*is;
+        t = t<1 ? t : 1;            // outside the support everything is 0
+        double t1 = 1-t, t4 = t1*t1*t1*t1;
+        phi = t4*t1*t1*(35*t*t+18*t+3);
+        psi = -56 * (5*t+1) * t4 * t1 * is2;
+        chi = 1680 * t4 * is2 * is2;
+    }
+};
+
+struct SoA_View{
+    const double *px, *py, *pz, *a, *gx, *gy, *gz;
+};
+
+/* sum over [be,ed) of a_i phi + g_i . grad phi, and its gradient a_i grad phi + Hess phi g_i,
+ * one pass over the SoA arrays with the sums kept in registers (omp simd: AVX2/AVX-512 with -march) */
+template<class Radial, bool isgrad>
+static void Kernel_Sum(const Radial &rad, const SoA_View &soa, int be, int ed, const double *p, double &val, double *grad){
+
+    const double *px = soa.px, *py = soa.py, *pz = soa.pz, *a = soa.a, *gx = soa.gx, *gy = soa.gy, *gz = soa.gz;
+    const double x = p[0], y = p[1], z = p[2];
+    double v = 0, g0 = 0, g1 = 0, g2 = 0;
+#pragma omp simd reduction(+:v,g0,g1,g2)
+    for(int i=be;i<ed;++i){
+        double dx = x-px[i], dy = y-py[i], dz = z-pz[i];
+        double r = sqrt(dx*dx+dy*dy+dz*dz), phi, psi, chi;
+        rad(r, phi, psi, chi);
+        double gd = gx[i]*dx+gy[i]*dy+gz[i]*dz;
+        v += a[i]*phi + psi*gd;
+        if(isgrad){
+            double s = a[i]*psi + chi*gd;
+            g0 += s*dx + psi*gx[i];
+            g1 += s*dy + psi*gy[i];
+            g2 += s*dz + psi*gz[i];
+        }
+    }
+    val += v;
+    if(isgrad){
+        grad[0] += g0;
+        grad[1] += g1;
+        grad[2] += g2;
+    }
+}
+
+
+bool RBF_Evaluator::Set(const RBF_Core &rbf, double treecode_theta){
+
+    npt = 0;
+    grid.Clear();
+    tree.Clear();
+    n_calls = 0;
+
+    if(!rbf.isHermite || rbf.a.n_elem!=(arma::uword)rbf.npt*4 || (rbf.kernal!=XCube && rbf.kernal!=Wendland)){
+        cout<<"RBF_Evaluator: needs the solved Hermite coefficients of the XCube or Wendland kernel"<<endl;
+        return false;
+    }
+
+    int n = rbf.npt;
+    kernal = rbf.kernal;
+    support = 0;
+    vector<int>order(n);
+    for(int i=0;i<n;++i)order[i] = i;
+    if(kernal==Wendland){
+        support = rbf.support_radius;
+        grid.Build(rbf.pts, support);
+        order = grid.order;
+    }
+
+    px.resize(n); py.resize(n); pz.resize(n);
+    a.resize(n); gx.resize(n); gy.resize(n); gz.resize(n);
+    for(int t=0;t<n;++t){
+        int i = order[t];
+        px[t] = rbf.pts[i*3];
+        py[t] = rbf.pts[i*3+1];
+        pz[t] = rbf.pts[i*3+2];
+        a[t] = rbf.a(i);
+        gx[t] = rbf.a(n+i);
+        gy[t] = rbf.a(n+i+n);
+        gz[t] = rbf.a(n+i+2*n);
+    }
+    b.assign(rbf.b.begin(), rbf.b.end());
+
+    if(kernal==XCube && treecode_theta>0)tree.Build(rbf.pts, rbf.a.memptr(), treecode_theta);
+
+    npt = n;
+    return true;
+}
+
+
+void RBF_Evaluator::Sum_Range(int be, int ed, const double *p, double &val, double *grad) const{
+
+    const SoA_View soa = {px.data(), py.data(), pz.data(), a.data(), gx.data(), gy.data(), gz.data()};
+    if(kernal==Wendland){
+        Wendland_Radial rad(support);
+        if(grad)Kernel_Sum<Wendland_Radial,true>(rad, soa, be, ed, p, val, grad);
+        else Kernel_Sum<Wendland_Radial,false>(rad, soa, be, ed, p, val, grad);
+    }else{
+        XCube_Radial rad;
+        if(grad)Kernel_Sum<XCube_Radial,true>(rad, soa, be, ed, p, val, grad);
+        else Kernel_Sum<XCube_Radial,false>(rad, soa, be, ed, p, val, grad);
+    }
+}
+
+double RBF_Evaluator::Poly(const double *p, double *grad) const{
+
+    double re = 0;
+    if(b.size()==4){
+        re = b[0];
+        for(int k=0;k<3;++k)re += b[k+1] * p[k];
+        if(grad)for(int k=0;k<3;++k)grad[k] += b[k+1];
+    }else if(b.size()==10){
+        /* the products buf[j]*buf[k], j<=k, of buf = (1,x,y,z), in the order of RBF_Core::Dist_Function */
+        double buf[4] = {1, p[0], p[1], p[2]};
+        int ind = 0;
+        for(int j=0;j<4;++j)for(int k=j;k<4;++k,++ind){
+            re += b[ind] * buf[j] * buf[k];
+            if(grad){
+                if(j>0)grad[j-1] += b[ind] * buf[k];
+                if(k>0)grad[k-1] += b[ind] * buf[j];
+            }
+        }
+    }
+    return re;
+}
+
+double RBF_Evaluator::Eval_Direct(const double *p, double *grad) const{
+
+    if(grad)for(int k=0;k<3;++k)grad[k] = 0;
+    double re = 0;
+    if(kernal==Wendland){
+        grid.Visit_Ranges(p, [&](int be, int ed){ Sum_Range(be, ed, p, re, grad); });
+    }else{
+        Sum_Range(0, npt, p, re, grad);
+    }
+    return re + Poly(p, grad);
+}
+
+double RBF_Evaluator::Eval_One(const double *p, double *grad) const{
+
+    if(tree.IsBuilt())return tree.Eval(p, grad) + Poly(p, grad);
+    return Eval_Direct(p, grad);
+}
+
+double RBF_Evaluator::Evaluate(const double *p, double *grad) const{
+
+    n_calls.fetch_add(1, std::memory_order_relaxed);
+    return Eval_One(p, grad);
+}
+
+double RBF_Evaluator::Evaluate_Direct(const double *p, double *grad) const{
+
+    n_calls.fetch_add(1, std::memory_order_relaxed);
+    return Eval_Direct(p, grad);
+}
+
+void RBF_Evaluator::Evaluate(const double *xyz, size_t count, double *out, double *grad) const{
+
+    n_calls.fetch_add(count, std::memory_order_relaxed);
+    const long long n = count;
+#pragma omp parallel for schedule(dynamic,64) if(n>=256)
+    for(long long i=0;i<n;++i)out[i] = Eval_One(xyz+i*3, grad ? grad+i*3 : NULL);
+}
+
+double RBF_Evaluator::Dist_Function(const R3Pt &in_pt, void *fdata){
+
+    return ((const RBF_Evaluator*)fdata)->Evaluate(&(in_pt[0]));
+}
+
+double RBF_Evaluator::Dist_Gradient(const R3Pt &in_pt, void *fdata, R3Vec &out_grad){
+
+    double grad[3];
+    double re = ((const RBF_Evaluator*)fdata)->Evaluate(&(in_pt[0]), grad);
+    for(int k=0;k<3;++k)out_grad[k] = grad[k];
+    return re;
+}
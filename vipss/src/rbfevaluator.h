@@ -0,0 +1,62 @@
+#ifndef RBFEVALUATOR_H
+#define RBFEVALUATOR_H
+
+#include <vector>
+#include <atomic>
+#include "rbfcore.h"
+#include "rbftree.h"
+#include "pointgrid.h"
+
+using namespace std;
+
+/* RBF_Evaluator: the solved Hermite implicit function
+ *   f(x) = sum_i a_i phi(|x-p_i|) + g_i . grad phi(x-p_i) + b_0 + b . x
+ * detached from RBF_Core: it owns a copy of the points, coefficients and kernel parameters and is
+ * immutable once Set, so that any number of threads may evaluate it and several models can coexist
+ * phi is XCube (optionally through the tree-code) or Wendland (through a grid over its support) */
+class RBF_Evaluator{
+public:
+    int npt = 0;
+    RBF_Kernal kernal = XCube;
+    double support = 0;
+
+    RBF_Evaluator(){}
+    RBF_Evaluator(const RBF_Core &rbf, double treecode_theta = 0){Set(rbf, treecode_theta);}
+    RBF_Evaluator(const RBF_Evaluator&) = delete;
+    RBF_Evaluator& operator=(const RBF_Evaluator&) = delete;
+
+    /* rbf must hold solved Hermite coefficients a, b; treecode_theta > 0 builds the tree-code (XCube only) */
+    bool Set(const RBF_Core &rbf, double treecode_theta = 0);
+    bool IsSet()const{return npt>0;}
+    bool IsTreeCode()const{return tree.IsBuilt();}
+
+    /* out[i] = f(xyz+3i), and grad+3i = grad f if grad is not NULL
+     * the queries are split over the OpenMP threads; with the tree-code, the far clusters of both f and
+     * grad f come from the expansion (grad f by differentiating it), the near ones are summed directly */
+    void Evaluate(const double *xyz, size_t count, double *out, double *grad = NULL) const;
+    double Evaluate(const double *p, double *grad = NULL) const;
+    /* without the tree-code */
+    double Evaluate_Direct(const double *p, double *grad = NULL) const;
+
+    /* polygonizer callbacks, fdata is the evaluator; Dist_Gradient returns f and sets grad f */
+    static double Dist_Function(const R3Pt &in_pt, void *fdata);
+    static double Dist_Gradient(const R3Pt &in_pt, void *fdata, R3Vec &out_grad);
+
+    long long N_Calls()const{return n_calls.load(std::memory_order_relaxed);}
+
+private:
+    /* structure of arrays: points, value coefficients and gradient coefficients, one array per component,
+     * in grid order for the Wendland kernel so that a grid cell is a contiguous range; b: polynomial */
+    vector<double>px, py, pz, a, gx, gy, gz, b;
+    PointGrid grid;
+    RBF_TreeEvaluator tree;
+    mutable std::atomic<long long>n_calls{0};
+
+    double Eval_One(const double *p, double *grad) const;
+    double Eval_Direct(const double *p, double *grad) const;
+    /* kernel sum over the points [be,ed), accumulated into val and grad */
+    void Sum_Range(int be, int ed, const double *p, double &val, double *grad) const;
+    double Poly(const double *p, double *grad) const;
+};
+
+#endif // RBFEVALUATOR_H
@@ -0,0 +1,257 @@
+#include "rbftree.h"
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+
+typedef std::chrono::high_resolution_clock Clock;
+
+void RBF_TreeEvaluator::Clear(){
+
+    nodes.clear();
+    sp.clear(); sa.clear(); sg.clear();
+    order.clear();
+    npt = 0;
+}
+
+void RBF_TreeEvaluator::Build(const vector<double>&pts, const double *a, double theta){
+
+    auto t1 = Clock::now();
+    Clear();
+    this->theta = theta;
+    npt = pts.size()/3;
+
+    order.resize(npt);
+    for(int i=0;i<npt;++i)order[i] = i;
+    sp = pts;
+    nodes.reserve(2*npt/leafsize+8);
+    Build_Node(0, npt, 0);
+
+    /* gather the points and coefficients in tree order, so that a leaf is contiguous */
+    sp.resize(npt*3); sa.resize(npt); sg.resize(npt*3);
+    for(int t=0;t<npt;++t){
+        int i = order[t];
+        for(int k=0;k<3;++k){
+            sp[t*3+k] = pts[i*3+k];
+            sg[t*3+k] = a[npt+i+k*npt];
+        }
+        sa[t] = a[i];
+    }
+    for(auto &node:nodes)Set_Moments(node);
+
+    cout<<"tree-code: "<<nodes.size()<<" nodes, theta "<<theta<<", build "
+       <<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+}
+
+/* split on the center of the bounding box of [be,ed) into octants, sp is still in input order here */
+int RBF_TreeEvaluator::Build_Node(int be, int ed, int depth){
+
+    int id = nodes.size();
+    nodes.push_back(Node());
+
+    double bmin[3], bmax[3];
+    for(int k=0;k<3;++k){
+        bmin[k] = bmax[k] = sp[order[be]*3+k];
+        for(int t=be;t<ed;++t){
+            bmin[k] = min(bmin[k], sp[order[t]*3+k]);
+            bmax[k] = max(bmax[k], sp[order[t]*3+k]);
+        }
+    }
+    double c[3];
+    for(int k=0;k<3;++k)nodes[id].c[k] = c[k] = (bmin[k]+bmax[k])/2;
+    nodes[id].be = be;
+    nodes[id].ed = ed;
+    nodes[id].isleaf = ed-be<=leafsize || depth>=32;
+    for(int k=0;k<8;++k)nodes[id].child[k] = -1;
+    if(nodes[id].isleaf)return id;
+
+    auto octant = [&](int i){
+        const double *p = sp.data()+i*3;
+        return (p[0]>c[0]) | ((p[1]>c[1])<<1) | ((p[2]>c[2])<<2);
+    };
+    stable_sort(order.begin()+be, order.begin()+ed, [&](int i, int j){return octant(i)<octant(j);});
+
+    int cbe = be;
+    for(int o=0;o<8;++o){
+        int ced = cbe;
+        while(ced<ed && octant(order[ced])==o)++ced;
+        if(ced>cbe){
+            int ch = Build_Node(cbe, ced, depth+1);
+            nodes[id].child[o] = ch;
+        }
+        cbe = ced;
+    }
+    return id;
+}
+
+/* moments about c of the sources in the node, delta = p - c, order m: a (-delta)^m / m! + g (-delta)^(m-1) / (m-1)!
+ * M1 = sum(g - a delta), M2 = sum(a/2 delta delta - g delta), M3 = sum(g delta delta / 2 - a/6 delta delta delta),
+ * M4 = sum(a/24 delta delta delta delta - g delta delta delta / 6) */
+void RBF_TreeEvaluator::Set_Moments(Node &node){
+
+    node.M0 = 0;
+    for(int k=0;k<3;++k)node.M1[k] = 0;
+    for(int k=0;k<9;++k)node.M2[k] = 0;
+    for(int k=0;k<27;++k)node.M3[k] = 0;
+    for(int k=0;k<81;++k)node.M4[k] = 0;
+    node.radius = 0;
+
+    for(int t=node.be;t<node.ed;++t){
+        double d[3], ai = sa[t];
+        const double *g = sg.data()+t*3;
+        for(int k=0;k<3;++k)d[k] = sp[t*3+k] - node.c[k];
+        node.radius = max(node.radius, sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]));
+
+        node.M0 += ai;
+        for(int i=0;i<3;++i)node.M1[i] += g[i] - ai*d[i];
+        for(int i=0;i<3;++i)for(int j=0;j<3;++j){
+            node.M2[i*3+j] += 0.5*ai*d[i]*d[j] - g[i]*d[j];
+            for(int k=0;k<3;++k){
+                node.M3[(i*3+j)*3+k] += 0.5*g[i]*d[j]*d[k] - ai*d[i]*d[j]*d[k]/6;
+                for(int l=0;l<3;++l)
+                    node.M4[((i*3+j)*3+k)*3+l] += ai*d[i]*d[j]*d[k]*d[l]/24 - g[i]*d[j]*d[k]*d[l]/6;
+            }
+        }
+    }
+
+    /* the terms of the derivatives of r^3 (see Far_Field) with Kronecker deltas only need these */
+    auto M3 = [&](int i, int j, int k){ return node.M3[(i*3+j)*3+k]; };
+    auto M4 = [&](int i, int j, int k, int l){ return node.M4[((i*3+j)*3+k)*3+l]; };
+    node.trM2 = node.M2[0] + node.M2[4] + node.M2[8];
+    node.tr4 = 0;
+    for(int a=0;a<3;++a){
+        node.V3[a] = 0;
+        for(int i=0;i<3;++i)node.V3[a] += M3(i,i,a) + M3(i,a,i) + M3(a,i,i);
+        for(int b=0;b<3;++b){
+            node.Q4[a*3+b] = 0;
+            for(int i=0;i<3;++i)node.Q4[a*3+b] += M4(i,i,a,b) + M4(i,a,i,b) + M4(i,a,b,i) + M4(a,i,i,b) + M4(a,i,b,i) + M4(a,b,i,i);
+            node.tr4 += M4(a,a,b,b) + M4(a,b,a,b) + M4(a,b,b,a);
+        }
+    }
+}
+
+/* a value and its gradient with respect to the query point: the far field below evaluated on Dual3
+ * gives the exact gradient of the expansion */
+struct Dual3{
+    double v, g[3];
+    Dual3(double v = 0):v(v){ g[0] = g[1] = g[2] = 0; }
+};
+static inline Dual3 operator+(const Dual3 &x, const Dual3 &y){
+    Dual3 re(x.v+y.v);
+    for(int k=0;k<3;++k)re.g[k] = x.g[k]+y.g[k];
+    return re;
+}
+static inline Dual3 operator-(const Dual3 &x, const Dual3 &y){
+    Dual3 re(x.v-y.v);
+    for(int k=0;k<3;++k)re.g[k] = x.g[k]-y.g[k];
+    return re;
+}
+static inline Dual3 operator*(const Dual3 &x, const Dual3 &y){
+    Dual3 re(x.v*y.v);
+    for(int k=0;k<3;++k)re.g[k] = x.g[k]*y.v + x.v*y.g[k];
+    return re;
+}
+static inline Dual3 operator*(double s, const Dual3 &x){
+    Dual3 re(s*x.v);
+    for(int k=0;k<3;++k)re.g[k] = s*x.g[k];
+    return re;
+}
+static inline Dual3 operator/(double s, const Dual3 &x){
+    Dual3 re(s/x.v);
+    double dre = -re.v/x.v;
+    for(int k=0;k<3;++k)re.g[k] = dre*x.g[k];
+    return re;
+}
+static inline Dual3 &operator+=(Dual3 &x, const Dual3 &y){ return x = x+y; }
+static inline Dual3 sqrt(const Dual3 &x){
+    Dual3 re(std::sqrt(x.v));
+    double dre = 0.5/re.v;
+    for(int k=0;k<3;++k)re.g[k] = dre*x.g[k];
+    return re;
+}
+
+/* far field of node at d = x - c, sum over m of M_m contracted with the m-th derivative of r^3:
+ *   D1_i = 3 r d_i,  D2_ij = 3(d_i d_j/r + delta_ij r),
+ *   D3_ijk = 3((delta_ij d_k + delta_ik d_j + delta_jk d_i)/r - d_i d_j d_k/r^3),
+ *   D4_ijkl = 3((delta_ij delta_kl + delta_ik delta_jl + delta_il delta_jk)/r
+ *               - (the six delta_.. d_. d_.)/r^3 + 3 d_i d_j d_k d_l/r^5) */
+template<class T>
+static T Far_Field(const RBF_TreeEvaluator::Node &node, const T d[3]){
+
+    using std::sqrt;
+    T r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+    T r = sqrt(r2), ir = 1/r, ir2 = ir*ir, ir3 = ir*ir2, ir5 = ir3*ir2;
+    T dd[9];
+    for(int i=0;i<3;++i)for(int j=0;j<3;++j)dd[i*3+j] = d[i]*d[j];
+
+    T m1 = 0, v3 = 0, m2 = 0, q4 = 0, m3 = 0, m4 = 0;
+    for(int i=0;i<3;++i){
+        m1 += node.M1[i]*d[i];
+        v3 += node.V3[i]*d[i];
+    }
+    for(int ij=0;ij<9;++ij){
+        m2 += node.M2[ij]*dd[ij];
+        q4 += node.Q4[ij]*dd[ij];
+        T s3 = 0, s4 = 0;
+        for(int k=0;k<3;++k)s3 += node.M3[ij*3+k]*d[k];
+        for(int kl=0;kl<9;++kl)s4 += node.M4[ij*9+kl]*dd[kl];
+        m3 += s3*dd[ij];
+        m4 += s4*dd[ij];
+    }
+    return node.M0*(r2*r) + 3*(r*m1) + 3*(m2*ir + node.trM2*r) + 3*(v3*ir - m3*ir3)
+            + 3*(node.tr4*ir - q4*ir3 + 3*(m4*ir5));
+}
+
+double RBF_TreeEvaluator::Eval_Leaf(const Node &node, const double *x, double *grad) const{
+
+    double re = 0;
+    for(int t=node.be;t<node.ed;++t){
+        const double *p = sp.data()+t*3, *g = sg.data()+t*3;
+        double d[3] = {x[0]-p[0], x[1]-p[1], x[2]-p[2]};
+        double r = sqrt(d[0]*d[0]+d[1]*d[1]+d[2]*d[2]);
+        double gd = g[0]*d[0]+g[1]*d[1]+g[2]*d[2];
+        re += sa[t]*r*r*r + 3*r*gd;
+        if(grad){
+            /* a grad r^3 + Hess r^3 g, Hess r^3 = 3(r I + d d^T/r) */
+            double s = 3*sa[t]*r + (r>1e-8 ? 3*gd/r : 0);
+            for(int k=0;k<3;++k)grad[k] += s*d[k] + 3*r*g[k];
+        }
+    }
+    return re;
+}
+
+double RBF_TreeEvaluator::Eval(const double *x, double *grad) const{
+
+    if(grad)for(int k=0;k<3;++k)grad[k] = 0;
+    double re = 0;
+    int stack[256], top = 0;
+    stack[top++] = 0;
+    while(top){
+        const Node &node = nodes[stack[--top]];
+        double d[3] = {x[0]-node.c[0], x[1]-node.c[1], x[2]-node.c[2]};
+        double r2 = d[0]*d[0]+d[1]*d[1]+d[2]*d[2];
+
+        if(node.radius*node.radius < theta*theta*r2){
+            if(grad){
+                Dual3 dd[3];
+                for(int k=0;k<3;++k){
+                    dd[k].v = d[k];
+                    dd[k].g[k] = 1;
+                }
+                Dual3 val = Far_Field(node, dd);
+                re += val.v;
+                for(int k=0;k<3;++k)grad[k] += val.g[k];
+            }else re += Far_Field(node, d);
+        }else if(node.isleaf)re += Eval_Leaf(node, x, grad);
+        else for(int o=0;o<8;++o)if(node.child[o]>=0)stack[top++] = node.child[o];
+    }
+    return re;
+}
+
+double RBF_TreeEvaluator::Eval_Direct(const double *x, double *grad) const{
+
+    if(grad)for(int k=0;k<3;++k)grad[k] = 0;
+    double re = 0;
+    for(auto &node:nodes)if(node.isleaf)re += Eval_Leaf(node, x, grad);
+    return re;
+}
@@ -0,0 +1,55 @@
+#ifndef RBFTREE_H
+#define RBFTREE_H
+
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+/* RBF_TreeEvaluator: tree-code evaluation of the Hermite |x|^3 implicit function
+ *   f(x) = sum_i a_i |x-p_i|^3 + g_i . 3|x-p_i|(x-p_i)
+ * (the polynomial part is left to the caller)
+ * an octree over the points keeps, per node, the moments of its sources about the node center up to
+ * the fourth order; a node whose radius is below theta times its distance to x is evaluated from its
+ * moments, the other nodes are opened down to the leaves, summed directly
+ * the moment of order m holds the value coefficients to delta^m and the gradient coefficients to
+ * delta^(m-1), so the relative error of both kinds of terms is ~ (radius/distance)^4, and the same for
+ * the gradient of f, which is the exact gradient of the expansion */
+class RBF_TreeEvaluator{
+public:
+
+    struct Node{
+        double c[3];
+        double radius;
+        int be, ed;             // points order[be,ed)
+        int child[8];
+        bool isleaf;
+        double M0, M1[3], M2[9], M3[27], M4[81];
+        /* contractions of the moments with the Kronecker deltas of the derivatives of r^3 */
+        double trM2, V3[3], Q4[9], tr4;
+    };
+
+    int npt = 0;
+    double theta = 0.5;
+    int leafsize = 32;
+    vector<Node>nodes;
+
+    /* a: the 4n Hermite coefficients, value block first then the x,y,z gradient blocks */
+    void Build(const vector<double>&pts, const double *a, double theta);
+    /* f(x), and grad f(x) if grad is not NULL */
+    double Eval(const double *x, double *grad = NULL) const;
+    double Eval_Direct(const double *x, double *grad = NULL) const;
+    bool IsBuilt()const{return !nodes.empty();}
+    void Clear();
+
+private:
+    /* points and coefficients in tree order: p, a, g interleaved per point */
+    vector<double>sp, sa, sg;
+    vector<int>order;
+
+    int Build_Node(int be, int ed, int depth);
+    void Set_Moments(Node &node);
+    double Eval_Leaf(const Node &node, const double *x, double *grad) const;
+};
+
+#endif // RBFTREE_H
@@ -4,8 +4,40 @@
 #include<fstream>
 #include<sstream>
 #include<assert.h>
+#include<algorithm>
+#include<stdlib.h>
+#include<string.h>
+#include<stdio.h>
+#ifndef _WIN32
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#endif
+#ifdef _OPENMP
+#include<omp.h>
+#endif
+/* std::from_chars for doubles (C++17, GCC 11, MSVC 2019), strtod otherwise */
+#if defined(__has_include)
+#if __has_include(<charconv>) && __cplusplus >= 201703L
+#include<charconv>
+#endif
+#endif
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define VIPSS_FROM_CHARS
+#endif
 using namespace std;
 
+/* little endian bytes of val at p (unaligned), as binary PLY wants whatever the host */
+template<class T>
+static inline void storeLittleEndian(char *p, T val){
+    unsigned char bytes[sizeof(T)];
+    memcpy(bytes, &val, sizeof(T));
+    const unsigned short one = 1;
+    if(*(const unsigned char*)&one==0)reverse(bytes, bytes+sizeof(T));
+    memcpy(p, bytes, sizeof(T));
+}
+
 bool readOffFile(string filename,vector<double>&vertices,vector<unsigned int>&faces2vertices){
     ifstream reader(filename.data(), ofstream::in);
     if (!reader.good()) {
@@ -91,129 +123,211 @@ bool writeOffFile(string filename,const vector<double>&vertices,const vector<uns
 
 }
 
-bool writePLYFile(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices,
-                  const vector<double>&vertices_normal,const vector<unsigned char>&vertices_color){
-    filename = filename + ".ply";
-    ofstream outer(filename.data(), ofstream::out);
-    if (!outer.good()) {
-        cout << "Can not create output PLY file " << filename << endl;
-        return false;
-    }
-
+/* header of a PLY file with n_vertices vertices (and normals, colors if hasnormal, hascolor) and n_faces
+ * triangles, or none if n_faces < 0; the counts are written in fields of countwidth characters */
+static void writePLYHeader(ostream &outer, int format, long long n_vertices, bool hasnormal, bool hascolor,
+                           long long n_faces, int countwidth = 0){
 
-    int n_vertices = vertices.size()/3;
-    int n_faces = faces2vertices.size()/3;
+    const char *scalar = format==PLY_BINARY_DOUBLE ? "double" : "float";
     outer << "ply" <<endl;
-    outer << "format ascii 1.0"<<endl;
-    outer << "element vertex " << n_vertices <<endl;
-    outer << "property float x" <<endl;
-    outer << "property float y" <<endl;
-    outer << "property float z" <<endl;
-    outer << "property float nx" <<endl;
-    outer << "property float ny" <<endl;
-    outer << "property float nz" <<endl;
-    outer << "property uchar red" <<endl;
-    outer << "property uchar green" <<endl;
-    outer << "property uchar blue" <<endl;
-    outer << "property uchar alpha" <<endl;
-    outer << "element face " << n_faces <<endl;
-    outer << "property list uchar int vertex_indices" <<endl;
+    if(format==PLY_ASCII)outer << "format ascii 1.0"<<endl;
+    else outer << "format binary_little_endian 1.0"<<endl;
+    outer << "element vertex " << setw(countwidth) << n_vertices <<endl;
+    outer << "property "<<scalar<<" x" <<endl;
+    outer << "property "<<scalar<<" y" <<endl;
+    outer << "property "<<scalar<<" z" <<endl;
+    if(hasnormal){
+        outer << "property "<<scalar<<" nx" <<endl;
+        outer << "property "<<scalar<<" ny" <<endl;
+        outer << "property "<<scalar<<" nz" <<endl;
+    }
+    if(hascolor){
+        outer << "property uchar red" <<endl;
+        outer << "property uchar green" <<endl;
+        outer << "property uchar blue" <<endl;
+        outer << "property uchar alpha" <<endl;
+    }
+    if(n_faces>=0){
+        outer << "element face " << setw(countwidth) << n_faces <<endl;
+        outer << "property list uchar int vertex_indices" <<endl;
+    }
     outer << "end_header" <<endl;
+}
 
-    for(int i=0;i<n_vertices;++i){
-        auto p_v = vertices.data()+i*3;
-        auto p_vn = vertices_normal.data()+i*3;
-        auto p_vc = vertices_color.data()+i*4;
-        for(int j=0;j<3;++j)outer << p_v[j] << " ";
-        for(int j=0;j<3;++j)outer << p_vn[j] << " ";
-        for(int j=0;j<4;++j)outer << int(p_vc[j]) << " ";
-        outer << endl;
+/* n vertex records: v, and vn and vc (4 per vertex) if not NULL */
+static void writePLYVertices(ostream &outer, int format, const double *v, const double *vn, const unsigned char *vc, int n){
+
+    if(format==PLY_ASCII){
+        /* enough digits to read back the same float */
+        outer << setprecision(9);
+        for(int i=0;i<n;++i){
+            for(int j=0;j<3;++j)outer << v[i*3+j] << " ";
+            if(vn!=NULL)for(int j=0;j<3;++j)outer << vn[i*3+j] << " ";
+            if(vc!=NULL)for(int j=0;j<4;++j)outer << int(vc[i*4+j]) << " ";
+            outer << '\n';
+        }
+        return;
+    }
+    /* one buffer, the records have fixed sizes so they are filled in parallel */
+    const int ssize = format==PLY_BINARY_DOUBLE ? 8 : 4;
+    const size_t vsize = (vn!=NULL ? 6 : 3)*ssize + (vc!=NULL ? 4 : 0);
+    vector<char> buf(vsize*n);
+#pragma omp parallel for schedule(static)
+    for(int i=0;i<n;++i){
+        char *p = buf.data() + vsize*i;
+        double val[6];
+        int nval = 0;
+        for(int j=0;j<3;++j)val[nval++] = v[i*3+j];
+        if(vn!=NULL)for(int j=0;j<3;++j)val[nval++] = vn[i*3+j];
+        for(int j=0;j<nval;++j,p+=ssize){
+            if(ssize==8)storeLittleEndian(p, val[j]);
+            else storeLittleEndian(p, (float)val[j]);
+        }
+        if(vc!=NULL)memcpy(p, vc+i*4, 4);
     }
+    outer.write(buf.data(), buf.size());
+}
 
-    for(int i=0;i<n_faces;++i){
-        auto p_fv = faces2vertices.data()+i*3;
-        outer << "3 ";
-        for(int j=0;j<3;++j)outer << p_fv[j] << " ";
-        outer << endl;
+/* n triangle records, 3 vertex ids each */
+static void writePLYFaces(ostream &outer, int format, const unsigned int *fv, int n){
+
+    if(format==PLY_ASCII){
+        for(int i=0;i<n;++i){
+            outer << "3 ";
+            for(int j=0;j<3;++j)outer << fv[i*3+j] << " ";
+            outer << '\n';
+        }
+        return;
     }
-    outer.close();
-    cout<<"saving finish: "<<filename<<endl;
-    return true;
+    const size_t fsize = 1 + 3*4;
+    vector<char> buf(fsize*n);
+#pragma omp parallel for schedule(static)
+    for(int i=0;i<n;++i){
+        char *p = buf.data() + fsize*i;
+        p[0] = 3;
+        for(int j=0;j<3;++j)storeLittleEndian(p+1+j*4, (int)fv[i*3+j]);
+    }
+    outer.write(buf.data(), buf.size());
 }
 
-bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices){
+/* the element vertex of the PLY file: vertices, and vertices_normal and vertices_color (4 per vertex)
+ * if not NULL; the element face if faces2vertices is not NULL */
+static bool writePLY(string filename, int format, const vector<double>&vertices, const vector<double>*vertices_normal,
+                     const vector<unsigned char>*vertices_color, const vector<unsigned int>*faces2vertices){
     filename = filename + ".ply";
-    ofstream outer(filename.data(), ofstream::out);
+    ofstream outer(filename.data(), format==PLY_ASCII ? ofstream::out : ofstream::out | ofstream::binary);
     if (!outer.good()) {
         cout << "Can not create output PLY file " << filename << endl;
         return false;
     }
 
-
     int n_vertices = vertices.size()/3;
-    int n_faces = faces2vertices.size()/3;
-    outer << "ply" <<endl;
-    outer << "format ascii 1.0"<<endl;
-    outer << "element vertex " << n_vertices <<endl;
-    outer << "property float x" <<endl;
-    outer << "property float y" <<endl;
-    outer << "property float z" <<endl;
-    outer << "element face " << n_faces <<endl;
-    outer << "property list uchar int vertex_indices" <<endl;
-    outer << "end_header" <<endl;
-
-    for(int i=0;i<n_vertices;++i){
-        auto p_v = vertices.data()+i*3;
-        for(int j=0;j<3;++j)outer << p_v[j] << " ";
-        outer << endl;
-    }
-
-    for(int i=0;i<n_faces;++i){
-        auto p_fv = faces2vertices.data()+i*3;
-        outer << "3 ";
-        for(int j=0;j<3;++j)outer << p_fv[j] << " ";
-        outer << endl;
-    }
+    int n_faces = faces2vertices==NULL ? -1 : faces2vertices->size()/3;
+    writePLYHeader(outer, format, n_vertices, vertices_normal!=NULL, vertices_color!=NULL, n_faces);
+    writePLYVertices(outer, format, vertices.data(), vertices_normal==NULL ? NULL : vertices_normal->data(),
+                     vertices_color==NULL ? NULL : vertices_color->data(), n_vertices);
+    if(n_faces>0)writePLYFaces(outer, format, faces2vertices->data(), n_faces);
     outer.close();
     cout<<"saving finish: "<<filename<<endl;
     return true;
 }
 
+bool writePLYFile(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices,
+                  const vector<double>&vertices_normal,const vector<unsigned char>&vertices_color, int format){
 
-bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal){
-    filename = filename + ".ply";
-    ofstream outer(filename.data(), ofstream::out);
-    if (!outer.good()) {
-        cout << "Can not create output PLY file " << filename << endl;
+    return writePLY(filename, format, vertices, &vertices_normal, &vertices_color, &faces2vertices);
+}
+
+bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices, int format){
+
+    return writePLY(filename, format, vertices, NULL, NULL, &faces2vertices);
+}
+
+bool writePLYFile_VFN(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices,
+                      const vector<double>&vertices_normal, int format){
+
+    return writePLY(filename, format, vertices, &vertices_normal, NULL, &faces2vertices);
+}
+
+bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal, int format){
+
+    return writePLY(filename, format, vertices, &vertices_normal, NULL, NULL);
+}
+
+
+
+bool PLYStream::Open(string filename, int format){
+
+    this->filename = filename + ".ply";
+    facename = this->filename + ".faces.tmp";
+    this->format = format;
+    n_vertices = n_faces = 0;
+    outer.open(this->filename.data(), ofstream::out | ofstream::binary);
+    facer.open(facename.data(), ofstream::out | ofstream::binary);
+    if (!outer.good() || !facer.good()) {
+        cout << "Can not create output PLY file " << this->filename << endl;
+        outer.close();
+        facer.close();
         return false;
     }
+    writePLYHeader(outer, format, 0, true, false, 0, COUNTWIDTH);
+    return true;
+}
 
-    int n_vertices = vertices.size()/3;
-    outer << "ply" <<endl;
-    outer << "format ascii 1.0"<<endl;
-    outer << "element vertex " << n_vertices <<endl;
-    outer << "property float x" <<endl;
-    outer << "property float y" <<endl;
-    outer << "property float z" <<endl;
-    outer << "property float nx" <<endl;
-    outer << "property float ny" <<endl;
-    outer << "property float nz" <<endl;
-    outer << "end_header" <<endl;
+void PLYStream::AddVertex(const double *v, const double *vn){
 
-    for(int i=0;i<n_vertices;++i){
-        auto p_v = vertices.data()+i*3;
-        auto p_vn = vertices_normal.data()+i*3;
-        for(int j=0;j<3;++j)outer << p_v[j] << " ";
-        for(int j=0;j<3;++j)outer << p_vn[j] << " ";
-        outer << endl;
-    }
+    vbuf.insert(vbuf.end(), v, v+3);
+    vnbuf.insert(vnbuf.end(), vn, vn+3);
+    ++n_vertices;
+    if(vbuf.size()>=CHUNK*3)FlushVertices();
+}
 
-    outer.close();
-    cout<<"saving finish: "<<filename<<endl;
-    return true;
+void PLYStream::AddFace(unsigned int i1, unsigned int i2, unsigned int i3){
+
+    fbuf.push_back(i1);
+    fbuf.push_back(i2);
+    fbuf.push_back(i3);
+    ++n_faces;
+    if(fbuf.size()>=CHUNK*3)FlushFaces();
+}
+
+void PLYStream::FlushVertices(){
+
+    writePLYVertices(outer, format, vbuf.data(), vnbuf.data(), NULL, vbuf.size()/3);
+    vbuf.clear();
+    vnbuf.clear();
 }
 
+void PLYStream::FlushFaces(){
+
+    writePLYFaces(facer, format, fbuf.data(), fbuf.size()/3);
+    fbuf.clear();
+}
 
+bool PLYStream::Close(){
+
+    if(!outer.is_open())return false;
+    FlushVertices();
+    FlushFaces();
+    facer.close();
+
+    ifstream reader(facename.data(), ifstream::in | ifstream::binary);
+    vector<char> block(1<<20);
+    while(reader.good()){
+        reader.read(block.data(), block.size());
+        outer.write(block.data(), reader.gcount());
+    }
+    reader.close();
+    remove(facename.data());
+
+    outer.seekp(0);
+    writePLYHeader(outer, format, n_vertices, true, false, n_faces, COUNTWIDTH);
+    bool isgood = outer.good();
+    outer.close();
+    if(isgood)cout<<"saving finish: "<<filename<<endl;
+    else cout << "Can not write output PLY file " << filename << endl;
+    return isgood;
+}
 
 bool readPLYFile(string filename,  vector<double>&vertices, vector<double> &vertices_normal){
     ifstream fin(filename.data());
@@ -1140,43 +1254,151 @@ bool writeCurNetFile(string filename, const vector<double> &vertices, const vect
 }
 
 
-bool readXYZ(string filename, vector<double>&v){
+bool MappedFile::Open(const string &filename){
 
-    ifstream reader(filename.data(), ofstream::in);
-    if (!reader.good()) {
+#ifdef _WIN32
+    ifstream reader(filename.data(), ifstream::in | ifstream::binary);
+    if (!reader.good())return false;
+    buf.assign(istreambuf_iterator<char>(reader), istreambuf_iterator<char>());
+    data = buf.data();
+    size = buf.size();
+    return true;
+#else
+    fd = open(filename.data(), O_RDONLY);
+    if(fd<0)return false;
+    struct stat st;
+    if(fstat(fd, &st)!=0)return false;
+    size = st.st_size;
+    if(size==0){
+        data = "";
+        return true;
+    }
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(addr==MAP_FAILED)return false;
+    madvise(addr, size, MADV_SEQUENTIAL);
+    data = (const char*)addr;
+    return true;
+#endif
+}
+
+MappedFile::~MappedFile(){
+
+#ifndef _WIN32
+    if(size>0 && data!=NULL)munmap((void*)data, size);
+    if(fd>=0)close(fd);
+#endif
+}
+
+static inline bool isSeparator(char c){ return c==' ' || c=='\t' || c==',' || c=='\r'; }
+
+/* the number at p (before end), followed by a separator or a line end; NULL if there is none */
+static const char *parseDouble(const char *p, const char *end, double &val){
+
+    if(p<end && *p=='+')++p;
+    const char *q = p;
+    while(q<end && !isSeparator(*q) && *q!='\n')++q;
+    if(q==p)return NULL;
+#ifdef VIPSS_FROM_CHARS
+    auto res = from_chars(p, q, val);
+    if(res.ec!=errc() || res.ptr!=q)return NULL;
+#else
+    /* strtod needs a terminated string, the mapped file is not */
+    char buf[64];
+    if(q-p>=(long)sizeof(buf))return NULL;
+    memcpy(buf, p, q-p);
+    buf[q-p] = 0;
+    char *e;
+    val = strtod(buf, &e);
+    if(e!=buf+(q-p))return NULL;
+#endif
+    return q;
+}
+
+/* the first ncol numbers of every line of [p,end) that has ncol numbers or more; returns the number of
+ * other lines that are not blank */
+static long long parseColumns(const char *p, const char *end, int ncol, vector<double> &out){
+
+    long long nskip = 0;
+    double val[16];
+    while(p<end){
+        int n = 0;
+        bool blank = true;
+        for(;;){
+            while(p<end && isSeparator(*p))++p;
+            if(p==end || *p=='\n')break;
+            blank = false;
+            const char *q = n<ncol ? parseDouble(p, end, val[n]) : NULL;
+            if(q==NULL)break;
+            ++n;
+            p = q;
+        }
+        if(n==ncol)out.insert(out.end(), val, val+ncol);
+        else if(!blank)++nskip;
+        p = (const char*)memchr(p, '\n', end-p);
+        p = p==NULL ? end : p+1;
+    }
+    return nskip;
+}
+
+/* lines of ncol numbers separated by spaces, tabs or commas (e.g. "x y z" or "x, y, z"), extra numbers
+ * are ignored and the lines with fewer (headers, point counts, comments) are skipped. The file is memory
+ * mapped and cut at line ends into chunks parsed by all the threads */
+static bool readColumns(string filename, int ncol, vector<double>&v){
+
+    MappedFile file;
+    if (!file.Open(filename)) {
         cout << "Can not open the file " << filename << endl;
         return false;
     }else {
         cout << "Reading: "<<filename<<endl;
     }
-    v.clear();
-    double val;
-    while(!reader.eof()){
-        reader>>val;
-        v.push_back(val);
+
+    int nthread = 1;
+#ifdef _OPENMP
+    nthread = omp_get_max_threads();
+#endif
+    const size_t minchunk = 1<<20;
+    int nchunk = (int)min((size_t)nthread*4, file.size/minchunk+1);
+    vector<size_t> bound(nchunk+1, file.size);
+    bound[0] = 0;
+    for(int c=1;c<nchunk;++c){
+        const char *p = (const char*)memchr(file.data+c*(file.size/nchunk), '\n', file.size-c*(file.size/nchunk));
+        bound[c] = max(bound[c-1], p==NULL ? file.size : (size_t)(p+1-file.data));
     }
-    reader.close();
+
+    vector<vector<double>> chunks(nchunk);
+    long long nskip = 0;
+#pragma omp parallel for schedule(dynamic,1) reduction(+:nskip)
+    for(int c=0;c<nchunk;++c){
+        chunks[c].reserve((bound[c+1]-bound[c])/8);
+        nskip += parseColumns(file.data+bound[c], file.data+bound[c+1], ncol, chunks[c]);
+    }
+
+    size_t total = 0;
+    for(auto &ch:chunks)total += ch.size();
+    v.clear();
+    v.reserve(total);
+    for(auto &ch:chunks)v.insert(v.end(), ch.begin(), ch.end());
+    if(nskip>0)cout<<nskip<<" lines without "<<ncol<<" numbers skipped"<<endl;
     return true;
 }
 
+bool readXYZ(string filename, vector<double>&v){
+
+    return readColumns(filename, 3, v);
+}
+
 bool readXYZnormal(string filename, vector<double>&v, vector<double>&vn){
 
-    ifstream reader(filename.data(), ofstream::in);
-    if (!reader.good()) {
-        cout << "Can not open the file " << filename << endl;
-        return false;
-    }else {
-        cout << "Reading: "<<filename<<endl;
+    vector<double> vvn;
+    if(!readColumns(filename, 6, vvn))return false;
+    size_t npt = vvn.size()/6;
+    v.resize(npt*3);
+    vn.resize(npt*3);
+    for(size_t i=0;i<npt;++i)for(int k=0;k<3;++k){
+        v[i*3+k] = vvn[i*6+k];
+        vn[i*3+k] = vvn[i*6+3+k];
     }
-    v.clear();
-    vn.clear();
-    double val;
-    while(!reader.eof()){
-        for(int i=0;i<3;++i){reader>>val;v.push_back(val);}
-        for(int i=0;i<3;++i){reader>>val;vn.push_back(val);}
-    }
-    reader.close();
-
     return true;
 }
 
@@ -4,6 +4,7 @@
 
 #include<vector>
 #include<string>
+#include<fstream>
 using namespace std;
 
 bool readOffFile(string filename,vector<double>&vertices,vector<unsigned int>&faces2vertices);
@@ -11,11 +12,46 @@ bool readOffFile(string filename,vector<double>&vertices,vector<unsigned int>&fa
 
 bool writeOffFile(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices);
 
-bool writePLYFile(string filename, const vector<double>&vertices, const vector<unsigned int>&faces2vertices,
-                  const vector<double> &vertices_normal, const vector<unsigned char>&vertices_color);
+/* encoding of the PLY files written: ascii, or binary little endian with float or double coordinates */
+enum PLYFormat{ PLY_ASCII = 0, PLY_BINARY_FLOAT, PLY_BINARY_DOUBLE };
 
-bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices);
-bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal);
+bool writePLYFile(string filename, const vector<double>&vertices, const vector<unsigned int>&faces2vertices,
+                  const vector<double> &vertices_normal, const vector<unsigned char>&vertices_color, int format = PLY_ASCII);
+
+bool writePLYFile_VF(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices, int format = PLY_ASCII);
+bool writePLYFile_VN(string filename,const vector<double>&vertices, const vector<double>&vertices_normal, int format = PLY_ASCII);
+bool writePLYFile_VFN(string filename,const vector<double>&vertices,const vector<unsigned int>&faces2vertices,
+                      const vector<double>&vertices_normal, int format = PLY_ASCII);
+
+/* PLY file of vertices with normals and triangles written piece by piece, e.g. straight from the
+ * polygonizer, without holding the mesh: vertices and faces are buffered by chunks, the faces are spooled
+ * to filename.faces.tmp until Close appends them and writes the final counts into the header */
+class PLYStream{
+public:
+    ~PLYStream(){ Close(); }
+
+    /* filename without the .ply extension, as the writers above */
+    bool Open(string filename, int format = PLY_ASCII);
+    void AddVertex(const double *v, const double *vn);
+    /* vertex ids counted from the first vertex added */
+    void AddFace(unsigned int i1, unsigned int i2, unsigned int i3);
+    bool Close();
+
+    long long n_vertices = 0, n_faces = 0;
+
+private:
+    static const int CHUNK = 1<<16;
+    static const int COUNTWIDTH = 20;   // width of the counts in the header, so it can be rewritten in place
+
+    int format = PLY_ASCII;
+    string filename, facename;
+    ofstream outer, facer;
+    vector<double> vbuf, vnbuf;
+    vector<unsigned int> fbuf;
+
+    void FlushVertices();
+    void FlushFaces();
+};
 
 bool readPLYFile(string filename,  vector<double>&vertices, vector<double> &vertices_normal);
 
@@ -70,6 +106,28 @@ bool writeCtrGraphFile(string filename, const vector<float> &vertices, const vec
 
 bool writeCurNetFile(string filename, const vector<double> &vertices, const vector<vector<int>>&edge2vertices, const vector<vector<int>>&edgeMat, const vector<vector<double>>&planepara, const vector<double>&verticesNor);
 
+/* read-only view of a whole file, memory mapped (read into a buffer on Windows) */
+class MappedFile{
+public:
+    const char *data = NULL;
+    size_t size = 0;
+
+    MappedFile(){}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+    bool Open(const string &filename);
+
+private:
+#ifdef _WIN32
+    string buf;
+#else
+    int fd = -1;
+#endif
+};
+
+/* lines of 3 (6 with the normals) numbers separated by spaces, tabs or commas, memory mapped and parsed
+ * by all the threads */
 bool readXYZ(string filename, vector<double>&v);
 bool readXYZnormal(string filename, vector<double>&v, vector<double>&vn);
 bool writeXYZ(string filename, vector<double>&v);
@@ -0,0 +1,186 @@
+#include "sparsesolver.h"
+#include <iostream>
+#include <cstring>
+#include <chrono>
+
+using namespace std;
+typedef std::chrono::high_resolution_clock Clock;
+
+SparseSPD_Solver::~SparseSPD_Solver(){
+
+    Clear();
+}
+
+#ifdef VIPSS_USE_CHOLMOD
+
+void SparseSPD_Solver::Clear(){
+
+    if(isstart){
+        if(L)cholmod_l_free_factor(&L, &c);
+        cholmod_l_finish(&c);
+    }
+    L = NULL;
+    isstart = false;
+    n = 0;
+}
+
+bool SparseSPD_Solver::Factorize(const arma::sp_mat &A){
+
+    Clear();
+    n = A.n_rows;
+    cholmod_l_start(&c);
+    isstart = true;
+
+    /* stype -1: only the lower triangle of A is read */
+    cholmod_sparse *cA = cholmod_l_allocate_sparse(n, n, A.n_nonzero, 1, 1, -1, CHOLMOD_REAL, &c);
+    SuiteSparse_long *p_col = (SuiteSparse_long*)cA->p, *p_row = (SuiteSparse_long*)cA->i;
+    for(int j=0;j<=n;++j)p_col[j] = A.col_ptrs[j];
+    for(arma::uword k=0;k<A.n_nonzero;++k)p_row[k] = A.row_indices[k];
+    memcpy(cA->x, A.values, A.n_nonzero*sizeof(double));
+
+    L = cholmod_l_analyze(cA, &c);
+    cholmod_l_factorize(cA, L, &c);
+    bool re = c.status==CHOLMOD_OK && L->minor==(size_t)n;
+    cholmod_l_free_sparse(&cA, &c);
+
+    if(!re)cout<<"cholmod: matrix not positive definite, minor "<<L->minor<<endl;
+    return re;
+}
+
+bool SparseSPD_Solver::Solve(const arma::mat &B, arma::mat &X){
+
+    cholmod_dense *cB = cholmod_l_allocate_dense(n, B.n_cols, n, CHOLMOD_REAL, &c);
+    memcpy(cB->x, B.memptr(), B.n_elem*sizeof(double));
+    cholmod_dense *cX = cholmod_l_solve(CHOLMOD_A, L, cB, &c);
+    cholmod_l_free_dense(&cB, &c);
+    if(!cX || c.status!=CHOLMOD_OK){
+        cout<<"cholmod: solve failed, status "<<c.status<<endl;
+        if(cX)cholmod_l_free_dense(&cX, &c);
+        return false;
+    }
+    X.set_size(n, B.n_cols);
+    memcpy(X.memptr(), cX->x, X.n_elem*sizeof(double));
+    cholmod_l_free_dense(&cX, &c);
+    return true;
+}
+
+#else
+
+void SparseSPD_Solver::Clear(){
+
+    A.reset();
+    invdiag.reset();
+    n = 0;
+}
+
+bool SparseSPD_Solver::Factorize(const arma::sp_mat &A){
+
+    n = A.n_rows;
+    this->A = A;
+    invdiag = arma::vec(A.diag());
+    if(invdiag.min()<=0){
+        cout<<"pcg: non positive diagonal"<<endl;
+        return false;
+    }
+    invdiag = 1 / invdiag;
+    return true;
+}
+
+/* Jacobi preconditioned CG, column by column; 1e-8 is below the tolerances of the outer iterations
+ * (LOBPCG 1e-6, L-BFGS 1e-7) */
+bool SparseSPD_Solver::Solve(const arma::mat &B, arma::mat &X){
+
+    const double tor = 1e-8;
+    const int maxIter = n;
+
+    X.zeros(n, B.n_cols);
+    for(arma::uword c=0;c<B.n_cols;++c){
+        arma::vec b = B.col(c);
+        double bnorm = arma::norm(b);
+        if(bnorm==0)continue;
+        arma::vec x(n, arma::fill::zeros), r = b, z = invdiag % r, p = z, Ap;
+        double rz = arma::dot(r, z);
+        int it = 0;
+        for(;it<maxIter;++it){
+            Ap = A * p;
+            double alpha = rz / arma::dot(p, Ap);
+            x += alpha * p;
+            r -= alpha * Ap;
+            if(arma::norm(r) < tor * bnorm)break;
+            z = invdiag % r;
+            double rz_new = arma::dot(r, z);
+            p = z + (rz_new / rz) * p;
+            rz = rz_new;
+        }
+        if(it==maxIter){
+            cout<<"pcg: not converged in "<<maxIter<<" iterations, residual "<<arma::norm(r)/bnorm<<endl;
+            return false;
+        }
+        X.col(c) = x;
+    }
+    return true;
+}
+
+#endif
+
+
+bool SparseHermite_Operator::Set(const arma::sp_mat &M, const arma::mat &N, double mu){
+
+    auto t1 = Clock::now();
+    n = M.n_rows / 4;
+    this->mu = mu;
+    this->N = N;
+
+    arma::sp_mat A = M;
+    if(mu!=0)for(int i=0;i<n;++i)A(i,i) += mu;
+    if(!A_solver.Factorize(A)){
+        Clear();
+        return false;
+    }
+
+    /* Schur complement of the polynomial block: C = N^T A^-1 N */
+    if(!A_solver.Solve(N, W)){
+        Clear();
+        return false;
+    }
+    Cinv = arma::inv_sympd(arma::symmatu(N.t() * W));
+
+    cout<<"sparse factorization (mu "<<mu<<", nnz "<<M.n_nonzero<<"): "
+       <<std::chrono::nanoseconds(Clock::now() - t1).count()/1e9<<endl;
+    return true;
+}
+
+void SparseHermite_Operator::Clear(){
+
+    A_solver.Clear();
+    N.reset();
+    W.reset();
+    Cinv.reset();
+    n = 0;
+}
+
+bool SparseHermite_Operator::Solve(const arma::mat &r, arma::mat &a, arma::mat &b){
+
+    if(!A_solver.Solve(r, a))return false;
+    b = Cinv * (N.t() * a);
+    a -= W * b;
+    return true;
+}
+
+bool SparseHermite_Operator::Apply(const arma::mat &X, arma::mat &Y){
+
+    arma::mat r(n*4, X.n_cols, arma::fill::zeros), a, b;
+    r.rows(n, n*4-1) = X;
+    if(!Solve(r, a, b))return false;
+    Y = a.rows(n, n*4-1);
+    return true;
+}
+
+bool SparseHermite_Operator::Apply(const double *x, double *y){
+
+    const arma::mat X(const_cast<double*>(x), n*3, 1, false, true);
+    arma::mat Y;
+    if(!Apply(X, Y))return false;
+    memcpy(y, Y.memptr(), n*3*sizeof(double));
+    return true;
+}
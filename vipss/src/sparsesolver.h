@@ -0,0 +1,64 @@
+#ifndef SPARSESOLVER_H
+#define SPARSESOLVER_H
+
+#include <armadillo>
+
+#ifdef VIPSS_USE_CHOLMOD
+#include <cholmod.h>
+#endif
+
+/* SparseSPD_Solver: solves A x = b for a sparse symmetric positive definite A
+ * with VIPSS_USE_CHOLMOD it is a CHOLMOD (supernodal, fill-reducing ordering) Cholesky factorization,
+ * otherwise a Jacobi preconditioned conjugate gradient on A, to a relative residual of 1e-8
+ * one solver must not be used by two threads at the same time */
+class SparseSPD_Solver{
+public:
+    int n = 0;
+
+    SparseSPD_Solver(){}
+    ~SparseSPD_Solver();
+    SparseSPD_Solver(const SparseSPD_Solver&) = delete;
+    SparseSPD_Solver& operator=(const SparseSPD_Solver&) = delete;
+
+    /* return false if A is not positive definite */
+    bool Factorize(const arma::sp_mat &A);
+    /* return false if the solve failed (CG not converged) */
+    bool Solve(const arma::mat &B, arma::mat &X);
+    void Clear();
+
+private:
+#ifdef VIPSS_USE_CHOLMOD
+    cholmod_common c;
+    cholmod_factor *L = NULL;
+    bool isstart = false;
+#else
+    arma::sp_mat A;
+    arma::vec invdiag;
+#endif
+};
+
+
+/* SparseHermite_Operator: the Hermite saddle system S = [M + mu E, N; N^T, 0] with a sparse SPD M,
+ * E the identity on the n value rows; solved through the Schur complement of its 4 polynomial rows
+ * Apply gives K(mu) x, the gradient block of S^-1 on the 3n gradient rows, without ever forming K */
+class SparseHermite_Operator{
+public:
+    int n = 0;
+    double mu = 0;
+
+    bool Set(const arma::sp_mat &M, const arma::mat &N, double mu);
+    bool IsSet()const{return n>0;}
+    void Clear();
+
+    /* S [a; b] = [r; 0], return false if the sparse solve failed */
+    bool Solve(const arma::mat &r, arma::mat &a, arma::mat &b);
+    /* Y = K(mu) X, X and Y have 3n rows, return false if the sparse solve failed */
+    bool Apply(const arma::mat &X, arma::mat &Y);
+    bool Apply(const double *x, double *y);
+
+private:
+    SparseSPD_Solver A_solver;
+    arma::mat N, W, Cinv;
+};
+
+#endif // SPARSESOLVER_H
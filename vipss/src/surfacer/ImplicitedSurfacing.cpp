@@ -1,10 +1,15 @@
 #include "ImplicitedSurfacing.h"
+#include "PolygonizerParallel.h"
 #include <chrono>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 typedef std::chrono::high_resolution_clock Clock;
 
 
 static Surfacer *p_ImplicitSurfacer;
+static PLYStream *p_Stream = NULL;
 
 static int TriProc(int in_i1, int in_i2, int in_i3, VERTICES vs) {
     const R3Pt pt = vs.ptr[in_i1].position;
@@ -27,6 +32,23 @@ static int TriProc(int in_i1, int in_i2, int in_i3, VERTICES vs) {
     return 1;
 }
 
+/* the triangles and vertices handed to the PLY stream as they come, in the order GetCurSurface gives */
+static int TriProc_Stream(int in_i1, int in_i2, int in_i3, VERTICES vs) {
+    p_Stream->AddFace( in_i1, in_i2, in_i3 );
+    return 1;
+}
+
+static void VertProc_Stream(VERTICES vs) {
+    for ( int i = 0; i < vs.count; i++ ) {
+        double v[3], vn[3];
+        for ( int j = 0; j < 3; j++ ) {
+            v[j] = vs.ptr[i].position[j];
+            vn[j] = vs.ptr[i].normal[j];
+        }
+        p_Stream->AddVertex( v, vn );
+    }
+}
+
 static void VertProc(VERTICES vs) {
     p_ImplicitSurfacer->s_aptSurface.need( vs.count );
     p_ImplicitSurfacer->s_avecSurface.need( vs.count );
@@ -80,17 +102,9 @@ void Surfacer::CalSurfacingPara(vector<double>&Vs, int nvoxels){
 
 
 
-int GetOffSurfacePoint(vector<double>&offPts, vector<double>&surPts, vector<uint>&surfv, vector<double>&testPts, double offthres){
-
-
-
-
-}
-
-
-
 double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeckall,
-                                    double (*function)(const R3Pt &in_pt)){
+                                    double (*function)(const R3Pt &in_pt, void *fdata), void *fdata,
+                                    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad)){
 
     p_ImplicitSurfacer = this;
     ClearBuffer();
@@ -104,41 +118,76 @@ double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeck
     double re_time;
     cout<<"Implicit Surfacing: "<<endl;
 
-    auto t1 = Clock::now();
+    /* world space, the box size is n_voxels * dSize */
+    const double offthres = dOffSurface * n_voxels * dSize;
 
+    auto t1 = Clock::now();
 
 
+    /* streaming: nothing is kept in s_aptSurface, s_afaceSurface, so GetCurSurface gives empty meshes */
+    auto triproc = TriProc;
+    auto vertproc = VertProc;
+    PLYStream stream;
+    if(!sStreamFile.empty()){
+        if(!stream.Open(sStreamFile, iPLYFormat))return 0;
+        p_Stream = &stream;
+        triproc = TriProc_Stream;
+        vertproc = VertProc_Stream;
+    }
 
-    if(!ischeckall){
-        polygonize(function, dSize, iBound, st, TriProc, VertProc);
-        GetCurSurface(all_v,all_fv);
+    if(dAdaptive>0){
+        /* octree over the whole box, every component */
+        polygonize_adaptive(function, fdata, gradfunction, dSize, iBound, dAdaptive, dTolerance, st, triproc, vertproc);
+        GetCurSurface(all_v,all_fv,all_vn);
+    }else if(bNarrowBand){
+        /* the input points lie on the zero set: they seed the band, every component in one pass */
+        polygonize_band(function, fdata, gradfunction, dSize, iBound, dTolerance, st, Vs.data(), Vs.size()/3, triproc, vertproc);
+        GetCurSurface(all_v,all_fv,all_vn);
+    }else if(bProgressive){
+        /* corner i of the lattice at st + i * dSize, so that the lattice of n_voxels holds the one of
+         * n_voxels_last when n_voxels is a multiple of it */
+        R3Pt start;
+        for(int j=0;j<3;++j)start[j] = st[j] + 0.5*dSize;
+        ParallelPolygonizer *pp = new ParallelPolygonizer(function, fdata, gradfunction, dSize, iBound, dTolerance*dSize, start);
+        if(pLastLevel!=NULL && n_voxels % n_voxels_last == 0)pp->Refine(*pLastLevel, n_voxels/n_voxels_last);
+        delete pLastLevel;
+        pp->Fronts(Vs.data(), Vs.size()/3, offthres);
+        printf("%lld evaluations, %d cubes\n", pp->n_evaluations, (int)pp->cubes.size());
+        if(!pp->cubes.empty() && pp->Output(triproc, vertproc))GetCurSurface(all_v,all_fv,all_vn);
+        pLastLevel = pp;
+        n_voxels_last = n_voxels;
+    }else if(!ischeckall){
+        /* one component, continued from st (the command line always checks all the components, see
+         * polygonize_components); on one thread the serial polygonizer, which needs no locking, otherwise
+         * the parallel one: the same mesh, with its vertices and triangles in lattice order */
+        bool isserial = true;
+#ifdef _OPENMP
+        isserial = omp_get_max_threads()==1;
+#endif
+        if(isserial)polygonize(function, fdata, gradfunction, dSize, iBound, dTolerance, st, triproc, vertproc);
+        else polygonize_parallel(function, fdata, gradfunction, dSize, iBound, dTolerance, st, triproc, vertproc);
+        GetCurSurface(all_v,all_fv,all_vn);
     }else{
 
-        vector<double>offPts;
-        vector<double>surPts;
+        /* the input points lie on the zero set: new fronts start from the points the surface found so far
+         * does not pass near, on one lattice with shared corners, until every component is found */
+        vector<double>surPts, surNors;
         vector<uint>surfv;
-        vector<double>testPts = Vs;
-
 
-        int ncomp = 0;
-        while(true){
-            ClearSingleComponentBuffer();
-            if(polygonize(function, dSize, iBound, st, TriProc, VertProc))break;
-
-            GetCurSurface(surPts,surfv);
-            InsertToCurSurface(surPts,surfv);
-            GetOffSurfacePoint(offPts,surPts,surfv,testPts,5e-2);
-            cout<<"ncomp found: "<<++ncomp<<" offpts: "<<offPts.size()/3<<endl;
-            if(offPts.size()<=10*3)break;
-            break;
-
-            for(int j=0;j<3;++j)st[j] = offPts[j];
-            testPts = offPts;
+        if(polygonize_components(function, fdata, gradfunction, dSize, iBound, dTolerance, st, Vs.data(), Vs.size()/3, offthres, triproc, vertproc)){
+            GetCurSurface(surPts,surfv,surNors);
+            InsertToCurSurface(surPts,surfv,surNors);
         }
 
 
     }
 
+    if(!sStreamFile.empty()){
+        stream.Close();
+        p_Stream = NULL;
+        cout<<"streamed "<<stream.n_vertices<<" vertices, "<<stream.n_faces<<" triangles"<<endl;
+    }
+
     cout<<"Implicit Surfacing Done."<<endl;
     auto t2 = Clock::now();
     cout << "Total Surfacing time: " <<  (re_time = std::chrono::nanoseconds(t2 - t1).count()/1e9) <<endl;
@@ -148,6 +197,11 @@ double Surfacer::Surfacing_Implicit(vector<double>&Vs,int n_voxels, bool ischeck
 }
 
 
+Surfacer::~Surfacer(){
+
+    delete pLastLevel;
+}
+
 void Surfacer::WriteSurface(string fname){
 
     writeObjFile(fname,all_v,all_fv);
@@ -160,6 +214,13 @@ void Surfacer::WriteSurface(vector<double> &v, vector<uint>&fv){
     fv = all_fv;
 }
 
+void Surfacer::WriteSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn){
+
+    v = all_v;
+    fv = all_fv;
+    vn = all_vn;
+}
+
 void Surfacer::WriteSurface(vector<double> **v, vector<uint> **fv){
 
     *v = &all_v;
@@ -171,6 +232,7 @@ void Surfacer::ClearBuffer(){
     ClearSingleComponentBuffer();
     all_v.clear();
     all_fv.clear();
+    all_vn.clear();
 }
 
 void Surfacer::ClearSingleComponentBuffer(){
@@ -179,11 +241,12 @@ void Surfacer::ClearSingleComponentBuffer(){
     s_afaceSurface.clearcompletely();
 }
 
-void Surfacer::GetCurSurface(vector<double>&v,vector<uint>&fv){
+void Surfacer::GetCurSurface(vector<double>&v,vector<uint>&fv,vector<double>&vn){
 
     int beInd = v.size()/3;
     for(int i=0;i<s_aptSurface.num();++i){
         for(int j=0;j<3;++j)v.push_back( s_aptSurface[i][j] );
+        for(int j=0;j<3;++j)vn.push_back( s_avecSurface[i][j] );
     }
 
     for(int i=0;i<s_afaceSurface.num();++i){
@@ -193,10 +256,11 @@ void Surfacer::GetCurSurface(vector<double>&v,vector<uint>&fv){
 }
 
 
-void Surfacer::InsertToCurSurface(vector<double>&v,vector<uint>&fv){
+void Surfacer::InsertToCurSurface(vector<double>&v,vector<uint>&fv,vector<double>&vn){
 
     int beInd = all_v.size()/3;
     all_v.insert(all_v.end(),v.begin(),v.end());
+    all_vn.insert(all_vn.end(),vn.begin(),vn.end());
 
     for(auto a:fv)all_fv.push_back(beInd+a);
 
@@ -4,6 +4,7 @@
 #include "Polygonizer.h"
 #include "../readers.h"
 
+class ParallelPolygonizer;
 
 class Surfacer{
 
@@ -17,23 +18,46 @@ public:
 
     vector<double>all_v;
     vector<uint>all_fv;
+    vector<double>all_vn;
 
     R3Pt st;
     double dSize;
     int iBound;
+    /* accuracy of the surface vertices relative to dSize, 0 for the bisections of the polygonizer */
+    double dTolerance = 0;
+    /* an input point farther than dOffSurface times the bounding box size from the surface found so far
+     * starts a new front (a new component), see polygonize_components */
+    double dOffSurface = 1e-2;
+    /* polygonize the narrow band of cubes around the input points instead of continuing from st */
+    bool bNarrowBand = false;
+    /* adaptive dual contouring, leaves refined down to dSize until within dAdaptive * dSize of the
+     * surface; off if dAdaptive <= 0 */
+    double dAdaptive = 0;
+    /* successive calls at growing n_voxels: the lattice of a call is kept, and when the next n_voxels is a
+     * multiple of it, its corner values and its crossed edges start the next one */
+    bool bProgressive = false;
+    /* if not empty, the surface goes straight from the polygonizer to sStreamFile.ply (encoding
+     * iPLYFormat) through a PLYStream, and all_v, all_fv, all_vn stay empty */
+    string sStreamFile;
+    int iPLYFormat = PLY_ASCII;
 
 
     Surfacer(){}
+    ~Surfacer();
 
     void CalSurfacingPara(vector<double>&Vs, int nvoxels);
 
+    /* fdata is handed back to function, e.g. an RBF_Evaluator
+     * gradfunction (value and gradient) gives the vertex normals, forward differences of function if NULL */
     double Surfacing_Implicit(vector<double>&Vs, int n_voxels, bool ischeckall,
-                   double (*function)(const R3Pt &in_pt));
+                   double (*function)(const R3Pt &in_pt, void *fdata), void *fdata,
+                   double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad) = NULL);
 
 
 
     void WriteSurface(string fname);
     void WriteSurface(vector<double> &v, vector<uint>&fv);
+    void WriteSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn);
     void WriteSurface(vector<double> **v, vector<uint>**fv);
 
     void ClearBuffer();
@@ -41,8 +65,11 @@ public:
     void ClearSingleComponentBuffer();
 
 private:
-    void GetCurSurface(vector<double> &v, vector<uint>&fv);
-    void InsertToCurSurface(vector<double>&v,vector<uint>&fv);
+    void GetCurSurface(vector<double> &v, vector<uint>&fv, vector<double> &vn);
+    void InsertToCurSurface(vector<double>&v,vector<uint>&fv,vector<double>&vn);
+
+    ParallelPolygonizer *pLastLevel = NULL;
+    int n_voxels_last = 0;
 
 
 
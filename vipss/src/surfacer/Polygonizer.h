@@ -24,15 +24,84 @@ extern "C" {
 #endif
 
 bool polygonize (
-    double (*function)(const R3Pt &in_pt),
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
     double size,
 	int bounds,
+    double tolerance,
     const R3Pt &in_ptStart,
 	int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
 	void (*vertproc)(VERTICES vertices)	
 	);
 
-/* see implicit.c for explanation of arguments */
+/* see implicit.c for explanation of arguments
+ * the single-thread path of Surfacer::Surfacing_Implicit, polygonize_parallel below gives the same mesh */
+
+/* same arguments and output, the cubes are processed by all the OpenMP threads (polygonizer_parallel.cpp)
+ * function and gradfunction must be thread safe */
+bool polygonize_parallel (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double tolerance,
+    const R3Pt &in_ptStart,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices)
+    );
+
+/* every component through the points pts (npt, xyz) in one pass: fronts started from the points farther
+ * than offthres (world space) from the surface found so far, sharing one lattice of cubes of size
+ * centered at in_ptStart and its corner values (polygonizer_parallel.cpp) */
+bool polygonize_components (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double tolerance,
+    const R3Pt &in_ptStart,
+    const double *pts,
+    int npt,
+    double offthres,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices)
+    );
+
+/* narrow band polygonization around the points pts (npt, xyz), which lie near the surface, on the lattice
+ * of cubes of size centered at in_ptStart; no starting point search, all the components through the
+ * points, the corners are evaluated in parallel batches (polygonizer_parallel.cpp) */
+bool polygonize_band (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double tolerance,
+    const R3Pt &in_ptStart,
+    const double *pts,
+    int npt,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices)
+    );
+
+/* adaptive dual contouring on an octree whose finest cubes have the given size, refined where the leaves
+ * are farther than error * size from the surface (polygonizer_adaptive.cpp); gradfunction is required,
+ * no starting point search, the root cube is centered at in_ptStart and covers bounds cubes around it */
+bool polygonize_adaptive (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double error,
+    double tolerance,
+    const R3Pt &in_ptStart,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices)
+    );
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,80 @@
+#ifndef POLYGONIZER_ADAPTIVE_H
+#define POLYGONIZER_ADAPTIVE_H
+
+#include "Polygonizer.h"
+#include <vector>
+#include <unordered_map>
+
+/* AdaptivePolygonizer: dual contouring of the implicit surface on an octree (Ju et al., "Dual Contouring
+ * of Hermite Data", SIGGRAPH 2002)
+ *   1. refinement, breadth first from the root cube: the new corners of a level (value and gradient) are
+ *      evaluated as one parallel batch and the crossed edges of the level are converged to the surface;
+ *      a crossed cell is split while its vertex is farther than error from the surface, or the normals at
+ *      its crossing points spread too much; a cell without crossed edge is split only when the tangent
+ *      plane of one of its corners crosses it, so that the thin parts are not lost
+ *   2. one vertex per leaf, at the minimizer of the quadratic error of the planes of the crossing points
+ *      (analytic gradient), clamped to the leaf
+ *   3. one polygon around every minimal crossed edge, an edge of the smallest leaves around it, so that
+ *      the mesh has no crack between leaves of different sizes
+ * function and gradfunction must be thread safe, gradfunction is required */
+class AdaptivePolygonizer{
+public:
+
+    typedef double (*FUNCTION)(const R3Pt &in_pt, void *fdata);
+    typedef double (*GRADFUNCTION)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad);
+
+    /* size: the finest cubes, bounds: half width of the root cube in cubes of size, error: distance
+     * tolerance of the leaves, tolerance: of the crossing points, as in converge */
+    AdaptivePolygonizer(FUNCTION function, void *fdata, GRADFUNCTION gradfunction,
+                        double size, int bounds, double error, double tolerance, const R3Pt &start);
+
+    void Build();
+    /* vertices and triangles (vertex ids, 3 per triangle), the triangles are oriented as in polygonize */
+    void Contour(std::vector<VERTEX> &vertices, std::vector<int> &triangles);
+
+    int depth;                      // level of the cubes of size, the root is level 0
+    int n_leaves = 0, n_corners = 0;
+
+private:
+
+    static const int MINDEPTH = 4;  // levels split whatever the error
+
+    struct Node{
+        int level, x, y, z;         // origin in cubes of size
+        bool leaf;
+        int vertex;                 // index in verts, -1 if none
+    };
+    struct Corner{
+        double value, grad[3];
+    };
+
+    FUNCTION function;
+    GRADFUNCTION gradfunction;
+    void *fdata;
+    double size, error, tolerance;
+    R3Pt start;
+
+    std::vector<Node> nodes;
+    std::unordered_map<unsigned long long, int> nodeindex;
+    std::unordered_map<unsigned long long, Corner> corners;
+    std::vector<VERTEX> verts;
+
+    static unsigned long long CornerKey(int x, int y, int z){
+        return ((unsigned long long)x<<40) | ((unsigned long long)y<<20) | (unsigned long long)z;
+    }
+    static unsigned long long NodeKey(int level, int x, int y, int z){
+        return ((unsigned long long)level<<60) | CornerKey(x, y, z);
+    }
+
+    /* lattice point (x,y,z) is at start + ((x,y,z) - 2^(depth-1)) * size */
+    void SetPoint(R3Pt &out_pt, int x, int y, int z) const;
+    const Corner &Corner_At(int x, int y, int z) const;
+    void Eval_Corners(const std::vector<int> &cells);
+    bool Tangent_Crosses(const Node &c) const;
+    /* node at level or above containing the point p2, in half cubes of size, -1 if outside the root */
+    int Locate(int level, const long long p2[3]) const;
+    /* vertex of a leaf without crossed edge, next to a minimal edge: the center projected on the surface */
+    void Center_Vertex(const Node &c, VERTEX &v) const;
+};
+
+#endif // POLYGONIZER_ADAPTIVE_H
@@ -0,0 +1,214 @@
+#ifndef POLYGONIZER_PARALLEL_H
+#define POLYGONIZER_PARALLEL_H
+
+#include "Polygonizer.h"
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <mutex>
+#include <atomic>
+
+/* ParallelPolygonizer: the continuation polygonizer of polygonizer.cpp (same lattice, same tetrahedral
+ * decomposition, same cubes visited) run by all the OpenMP threads
+ *   1. propagation: the active cubes are spread over per-thread deques, a thread works LIFO on its own
+ *      deque and steals the oldest cube of another one when it runs dry; the corner values and the
+ *      visited cube centers live in sharded open addressing tables locked per shard, so a corner is
+ *      evaluated once (up to a rare race, where the value is the same anyway)
+ *      or, with Band, breadth first from the cubes of the input points, one batch of corners per level
+ *   2. triangulation: the visited cubes and their crossing edges are sorted by lattice key, so the vertex
+ *      ids and the triangle order do not depend on the scheduling; the vertices (converge + normal) are
+ *      computed in parallel
+ * function (and gradfunction) must be safe to call from several threads, e.g. RBF_Evaluator */
+class ParallelPolygonizer{
+public:
+
+    typedef double (*FUNCTION)(const R3Pt &in_pt, void *fdata);
+    typedef double (*GRADFUNCTION)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad);
+
+    struct Cube{
+        int i, j, k;
+        double value[8];            // corner n at (i+BIT(n,2), j+BIT(n,1), k+BIT(n,0))
+    };
+
+    /* tolerance: distance tolerance of the vertices, 0 for the bisections of converge */
+    ParallelPolygonizer(FUNCTION function, void *fdata, GRADFUNCTION gradfunction,
+                        double size, int bounds, double tolerance, const R3Pt &start);
+
+    static long long Key(int i, int j, int k){
+        return ((long long)(i+(1<<20))<<42) | ((long long)(j+(1<<20))<<21) | (long long)(k+(1<<20));
+    }
+
+    /* lattice corner (i,j,k) is at start + (i-0.5, j-0.5, k-0.5) * size */
+    void SetPoint(R3Pt &out_pt, int i, int j, int k) const;
+    double Corner(int i, int j, int k);
+
+    /* visit every cube connected to the seeds through faces crossed by the surface
+     * may be called again with new seeds: the corners and the visited cubes are kept */
+    void Propagate(const std::vector<Cube> &seeds);
+    /* narrow band: the cubes containing the points (xyz, npt), then level by level their neighbors across
+     * the crossed faces; the new corners of a level are evaluated as one parallel batch
+     * only the cubes crossed by the surface are kept */
+    void Band(const double *pts, int npt);
+
+    /* cube containing the point p */
+    void Cube_Of(const double *p, int &i, int &j, int &k) const;
+    /* the cubes within reach cubes of the points (xyz, npt), to start new fronts from */
+    void Seeds(const double *pts, int npt, int reach, std::vector<Cube> &seeds) const;
+    /* true if a visited cube crossed by the surface is within offthres (world space) of p, i.e. the
+     * surface found so far passes near p; Index_Crossed must be called after the last Propagate */
+    bool Covered(const double *p, double offthres) const;
+    void Index_Crossed(double offthres);
+    /* fronts from a few of the points (xyz, npt) farther than offthres from the crossed cubes, until all of
+     * them are covered; a point whose front crossed nothing near it is off the surface and dropped */
+    void Fronts(const double *pts, int npt, double offthres);
+    /* start from coarse, on the lattice of every ratio-th corner of this one: its corner values are copied
+     * and the surface is followed from the piece of this lattice crossed on each of its crossed edges */
+    void Refine(const ParallelPolygonizer &coarse, int ratio);
+    /* vertices and triangles (vertex ids, 3 per triangle) of the visited cubes */
+    void Triangulate(std::vector<VERTEX> &vertices, std::vector<int> &triangles);
+    /* Triangulate and hand the mesh to triproc and vertproc, see polygonize */
+    bool Output(int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+                void (*vertproc)(VERTICES vertices));
+
+    std::vector<Cube> cubes;        // visited cubes, sorted by lattice key after Triangulate
+    long long n_evaluations = 0;
+
+    /* buffer allocations of the corner and center tables, the work queues and the cube arenas */
+    long long Allocations() const;
+    /* entries of the corner and center tables, each a node of its own in a chained table */
+    void Entries(long long &ncorner, long long &ncenter) const;
+
+private:
+
+    /* open addressing table on the packed lattice keys of Key (>= 0), linear probing, doubled when half
+     * full: one slot array per table instead of one node per entry */
+    template<class V>
+    struct KeyTable{
+        struct Slot{
+            long long key;
+            V value;
+        };
+        std::vector<Slot> slots;
+        size_t count = 0;
+        int bits = 0;
+        long long n_allocations = 0;
+
+        /* splitmix64 finalizer: independent of the multiplicative hash of Shard, whose top bits all the
+         * keys of a shard share */
+        size_t Home(long long key) const{
+            unsigned long long h = (unsigned long long)key;
+            h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+            return (size_t)((h ^ (h >> 31)) >> (64-bits));
+        }
+        V *Find(long long key){
+            if(slots.empty())return NULL;
+            const size_t mask = slots.size()-1;
+            for(size_t h=Home(key);;h=(h+1)&mask){
+                if(slots[h].key==key)return &slots[h].value;
+                if(slots[h].key<0)return NULL;
+            }
+        }
+        const V *Find(long long key) const{ return const_cast<KeyTable*>(this)->Find(key); }
+        /* the value of key, and true if it was inserted with value v */
+        std::pair<V*,bool> Insert(long long key, const V &v){
+            if(2*(count+1) > slots.size())Grow();
+            const size_t mask = slots.size()-1;
+            size_t h = Home(key);
+            for(;slots[h].key>=0;h=(h+1)&mask)
+                if(slots[h].key==key)return std::make_pair(&slots[h].value, false);
+            slots[h].key = key;
+            slots[h].value = v;
+            ++count;
+            return std::make_pair(&slots[h].value, true);
+        }
+        void Grow(){
+            std::vector<Slot> old;
+            old.swap(slots);
+            bits = std::max(bits+1, 12);
+            Slot empty;
+            empty.key = -1;
+            slots.assign(size_t(1)<<bits, empty);
+            ++n_allocations;
+            const size_t mask = slots.size()-1;
+            for(const Slot &sl:old)if(sl.key>=0){
+                size_t h = Home(sl.key);
+                while(slots[h].key>=0)h = (h+1)&mask;
+                slots[h] = sl;
+            }
+        }
+        template<class F>
+        void For_Each(F f) const{ for(const Slot &sl:slots)if(sl.key>=0)f(sl.key, sl.value); }
+        void Clear(){
+            std::vector<Slot>().swap(slots);
+            count = 0;
+            bits = 0;
+        }
+    };
+
+    static const int NSHARD = 64;
+    struct CornerShard{
+        std::mutex m;
+        KeyTable<double> mp;
+    };
+    struct CenterShard{
+        std::mutex m;
+        KeyTable<char> st;
+    };
+    /* ring buffer of cubes, doubled when full */
+    struct WorkQueue{
+        std::mutex m;
+        std::vector<Cube> buf;
+        size_t head = 0, count = 0;
+        long long n_allocations = 0;
+
+        void Push_Back(const Cube &c);
+        bool Pop_Back(Cube &c);
+        bool Pop_Front(Cube &c);
+    };
+    /* the cubes visited by one thread, in chunks that are never moved */
+    struct CubeArena{
+        static const size_t CHUNK = 4096;
+        std::vector<std::vector<Cube>> chunks;
+        size_t count = 0;
+
+        void Push(const Cube &c){
+            if(chunks.empty() || chunks.back().size()==CHUNK){
+                chunks.push_back(std::vector<Cube>());
+                chunks.back().reserve(CHUNK);
+            }
+            chunks.back().push_back(c);
+            ++count;
+        }
+    };
+
+    FUNCTION function;
+    GRADFUNCTION gradfunction;
+    void *fdata;
+    double size, delta, tolerance;
+    int bounds;
+    R3Pt start;
+
+    CornerShard corners[NSHARD];
+    CenterShard centers[NSHARD];
+    std::vector<WorkQueue*> queues;
+    /* the crossed cubes among cubes[0,n_crossed), (i,j,k) bucketed by the cell of side crossedcell
+     * (offthres + size) holding their center, so the ones within offthres of a point are in its 27 cells */
+    KeyTable<int> crossed;                      // cell key -> last cube of the cell in crossedijk
+    std::vector<int> crossedijk, crossednext;   // (i,j,k) per crossed cube, previous cube of its cell or -1
+    double crossedcell = 0;
+    size_t n_crossed = 0;
+    std::atomic<long long> pending, n_eval;
+    /* allocations of the queues, the arenas and the tables outside the shards (Band, cubes) */
+    long long n_allocations = 0;
+
+    static int Shard(long long key){ return (int)(((unsigned long long)key * 0x9E3779B97F4A7C15ULL) >> 58); }
+    /* return true if (i,j,k) was already set */
+    bool SetCenter(int i, int j, int k);
+    void Push(int tid, const Cube &c);
+    bool Pop(int tid, Cube &c);
+    void Process(int tid, Cube &c, CubeArena &visited);
+    void Normal(const R3Pt &in_point, R3Vec &out_vec) const;
+};
+
+#endif // POLYGONIZER_PARALLEL_H
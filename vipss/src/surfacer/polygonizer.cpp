@@ -45,6 +45,7 @@
 #include <sys/types.h>
 
 #define RES     10 /* # converge iterations    */
+#define MAXITER 50 /* # converge iterations, with a tolerance */
 
 #define L       0  /* left direction:   -x, -i */
 #define R       1  /* right direction:  +x, +i */
@@ -65,11 +66,8 @@
  * (start.x+(i-.5)*size, start.y+(j-.5)*size, start.z+(k-.5)*size) */
 
 #define RAND()    ((rand()&32767)/32767.)  /* random number, 0--1 */
-#define HASHBIT   (5)
-#define HSIZE     (size_t)(1<<(3*HASHBIT)) /* hash table size (32768) */
-#define MASK      ((1<<HASHBIT)-1)
-#define HASH(i,j,k) \
-((((((i)&MASK)<<HASHBIT)|((j)&MASK))<<HASHBIT)|((k)&MASK))
+#define HTBITS    (15)     /* initial hash table size (32768), the tables grow */
+#define LATTICEBITS (19)   /* |i|, |j|, |k| < 2^18 for the packed edge keys */
 #define BIT(i, bit) (((i)>>(bit))&1)
 #define FLIP(i,bit) ((i)^1<<(bit)) /* flip the given bit of i */
 
@@ -83,32 +81,22 @@ typedef struct {                   /* test the function for a signed value */
     int ok;                        /* if value is of correct sign */
 } TEST;
 
-typedef struct cornerlist {        /* list of corners */
+typedef struct {                   /* corner */
     int i, j, k;                   /* corner id */
-    double value;                   /* corner value */
-    struct cornerlist *next;       /* remaining elements */
-} CORNERLIST;
+    double value;                  /* corner value */
+} CORNER;
 
 typedef struct {                   /* partitioning cell (cube) */
     int i, j, k;                   /* lattice location of cube */
-    CORNERLIST *corners[8];        /* eight corners */
+    int corners[8];                /* eight corners, indices in the corner buffer */
 } CUBE;
 
-typedef struct cubes {             /* linked list (stack) of cubes */
-    CUBE cube;                     /* a single cube */
-    struct cubes *next;            /* remaining elements */
-} CUBES;
-
-typedef struct centerlist {        /* list of cube locations */
-    int i, j, k;                   /* cube location */
-    struct centerlist *next;       /* remaining elements */
-} CENTERLIST;
-
-typedef struct edgelist {          /* list of edges */
-    int i1, j1, k1, i2, j2, k2;    /* edge corner ids */
-    int vid;                       /* vertex id */
-    struct edgelist *next;         /* remaining elements */
-} EDGELIST;
+typedef struct {                   /* open addressing hash table, linear probing */
+    unsigned long long *keys;      /* packed lattice keys, 0 for an empty slot */
+    int *values;                   /* corner index, vertex id */
+    int bits;                      /* 2^bits slots, at most half full */
+    int count;                     /* # keys */
+} HTABLE;
 
 typedef struct intlist {           /* list of integers */
     int i;                         /* an integer */
@@ -122,17 +110,26 @@ typedef struct intlists {          /* list of list of integers */
 
 typedef struct process {           /* parameters, function, storage */
     double (*function)
-      (const R3Pt &in_pt);         /* implicit surface function */
+      (const R3Pt &in_pt,
+       void *fdata);               /* implicit surface function */
+    void *fdata;                   /* passed back to function */
+    double (*gradfunction)
+      (const R3Pt &in_pt, void *fdata,
+       R3Vec &out_grad);           /* value and gradient, or NULL */
     int (*triproc)(int i1, int i2,
       int i3, VERTICES vertices);  /* triangle output function */
     double size, delta;             /* cube size, normal delta */
+    double tolerance;              /* vertex distance tolerance, 0 for RES bisections */
     int bounds;                    /* cube range within lattice */
     R3Pt start;                   /* start point on surface */
-    CUBES *cubes;                  /* active cubes */
+    CUBE *cubes;                   /* active cubes (stack) */
+    int ncubes, maxcubes;          /* # active cubes, allocated */
+    CORNER *cornerbuf;             /* all corners, in order of evaluation */
+    int ncorners, maxcorners;      /* # corners, allocated */
     VERTICES vertices;             /* surface vertices */
-    CENTERLIST **centers;          /* cube center hash table */
-    CORNERLIST **corners;          /* corner value hash table */
-    EDGELIST **edges;              /* edge and vertex id hash table */
+    HTABLE centers;                /* cube center hash table */
+    HTABLE corners;                /* corner index hash table */
+    HTABLE edges;                  /* edge and vertex id hash table */
 } PROCESS;
 
 
@@ -140,17 +137,27 @@ void freeprocess (PROCESS *p);
 
 int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p);
 
-int setcenter(CENTERLIST *table[], int i, int j, int k);
+int setcenter(PROCESS *p, int i, int j, int k);
 
-int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p);
+int vertid (CORNER *c1, CORNER *c2, PROCESS *p);
 
 
 char *mycalloc (int nitems, int nbytes);
-CORNERLIST *setcorner (PROCESS *p, int i, int j, int k);
+char *myrealloc (char *ptr, int nitems, int nbytes);
+int setcorner (PROCESS *p, int i, int j, int k);
+
+unsigned long long latticekey (int i, int j, int k);
+void htinit (HTABLE *table, int bits);
+void htfree (HTABLE *table);
+int htget (const HTABLE *table, unsigned long long key);
+void htput (HTABLE *table, unsigned long long key, int value);
 
-void converge ( const R3Pt &in_p1, const R3Pt &p2, double v,
-                double (*function)(const R3Pt &in_pt),
-                R3Pt &p);
+static long n_allocations = 0;     /* calls to mycalloc and myrealloc in the current polygonize */
+
+void converge ( const R3Pt &in_p1, const R3Pt &p2, double v1, double v2,
+                double (*function)(const R3Pt &in_pt, void *fdata),
+                double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+                void *fdata, double tolerance, R3Pt &p);
 
 TEST find (int sign, PROCESS *p, const R3Pt &in_pt);
 
@@ -446,13 +453,21 @@ void testface ( int i, int j, int k,
 
 /* polygonize: polygonize the implicit surface function
  *   arguments are:
- *       double function (const R3Pt &in_pt)
+ *       double function (const R3Pt &in_pt, void *fdata)
  *           the implicit surface function given an arbitrary point
  *           return negative for inside, positive for outside
+ *       void *fdata
+ *           passed back to every call of function, no global state is kept
+ *       double gradfunction (const R3Pt &in_pt, void *fdata, R3Vec &out_grad)
+ *           the function value and its gradient, used for the vertex normals
+ *           may be NULL, then the normals are forward differences of function
  *       double size
  *           width of the partitioning cube
  *       int bounds
  *           max. range of cubes (+/- on the three axes) from first cube
+ *       double tolerance
+ *           accuracy of the vertices on the cube edges, relative to size
+ *           0 for a fixed number of bisections, see converge
  *       double x, y, z
  *           coordinates of a starting point on or near the surface
  *           may be defaulted to 0., 0., 0.
@@ -466,13 +481,16 @@ void testface ( int i, int j, int k,
  *               in a left-handed coordinate system
  *           vertex normals point outwards
  *           return 1 to continue, 0 to abort
- *   returns error or NULL
+ *   returns false on error
  */
 
 bool polygonize (
-    double (*function)(const R3Pt &in_pt),
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
     double size,
     int bounds,
+    double tolerance,
     const R3Pt &in_pt,
     int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
 	void (*vertproc)(VERTICES vertices))
@@ -482,15 +500,26 @@ bool polygonize (
     TEST in, out;
     
     p.function = function;
+    p.fdata = fdata;
+    p.gradfunction = gradfunction;
     p.triproc = triproc;
     p.size = size;
     p.bounds = bounds;
     p.delta = size/(double)(RES*RES);
+    p.tolerance = tolerance > 0.0 ? tolerance*size : 0.0;
+
+    if (p.bounds > (1<<(LATTICEBITS-1))-2) p.bounds = (1<<(LATTICEBITS-1))-2;
+    n_allocations = 0;
 
-    /* allocate hash tables: */
-    p.centers = (CENTERLIST **) mycalloc(HSIZE, sizeof(CENTERLIST *));
-    p.corners = (CORNERLIST **) mycalloc(HSIZE,   sizeof(CORNERLIST *));
-    p.edges   = (EDGELIST   **) mycalloc(2*HSIZE, sizeof(EDGELIST *));
+    /* allocate hash tables and buffers: */
+    htinit(&p.centers, HTBITS);
+    htinit(&p.corners, HTBITS);
+    htinit(&p.edges, HTBITS+1);
+    p.ncubes = p.ncorners = 0;
+    p.maxcubes = 1024;
+    p.maxcorners = 1<<HTBITS;
+    p.cubes = (CUBE *) mycalloc(p.maxcubes, sizeof(CUBE));
+    p.cornerbuf = (CORNER *) mycalloc(p.maxcorners, sizeof(CORNER));
 
     p.vertices.count = p.vertices.max = 0; /* no vertices yet */
     p.vertices.ptr = NULL;
@@ -506,24 +535,22 @@ bool polygonize (
         cerr << "ERR: polyganizer can't find starting point\n";
 		return false;
     }
-    converge(in.p, out.p, in.value, p.function, p.start);
+    converge(in.p, out.p, in.value, out.value, p.function, p.gradfunction, p.fdata, p.tolerance, p.start);
 
     /* push initial cube on stack: */
-    p.cubes = (CUBES *) mycalloc(1, sizeof(CUBES)); /* list of 1 */
-    p.cubes->cube.i = p.cubes->cube.j = p.cubes->cube.k = 0;
-    p.cubes->next = NULL;
+    p.ncubes = 1;
+    p.cubes[0].i = p.cubes[0].j = p.cubes[0].k = 0;
 
     /* set corners of initial cube: */
     for (n = 0; n < 8; n++)
-        p.cubes->cube.corners[n] = \
+        p.cubes[0].corners[n] = \
             setcorner(&p, BIT(n,2), BIT(n,1), BIT(n,0));
 
-    setcenter(p.centers, 0, 0, 0);
+    setcenter(&p, 0, 0, 0);
 
-    while (p.cubes != NULL) { /* process active cubes till none left */
+    while (p.ncubes > 0) { /* process active cubes till none left */
         CUBE c;
-        CUBES *temp = p.cubes;
-        c = p.cubes->cube;
+        c = p.cubes[p.ncubes-1];
 
         /* decompose into tetrahedra and polygonize: */
         if (!(dotet(&c, LBN, LTN, RBN, LBF, &p) &&
@@ -539,8 +566,7 @@ bool polygonize (
          }
 
         /* pop current cube from stack */
-        p.cubes = p.cubes->next;
-        free((char *) temp);
+        p.ncubes--;
         /* test six face directions, maybe add to stack: */
         testface(c.i-1, c.j, c.k, &c, L, LBN, LBF, LTN, LTF, &p);
         testface(c.i+1, c.j, c.k, &c, R, RBN, RBF, RTN, RTF, &p);
@@ -552,40 +578,24 @@ bool polygonize (
 
     gvertices = p.vertices;
 	vertproc( gvertices );
+    printf("polygonize: %d cubes, %d corners, %d vertices, %ld allocations\n",
+           p.centers.count, p.ncorners, p.vertices.count, n_allocations);
 
 	//cout << "Starting to write\n";
     //Write();
     freeprocess(&p);
 
-    return NULL;
+    return true;
 }
 
 /* freeprocess: free all allocated memory */
 
 void freeprocess (PROCESS *p) {
-    int index;
-    CORNERLIST *l, *lnext;
-    CENTERLIST *cl, *clnext;
-    EDGELIST *edge, *edgenext;
-
-    for (index = 0; index < HSIZE; index++)
-        for (l = p->corners[index]; l; l = lnext) {
-            lnext = l->next;
-            free((char *) l);           /* free CORNERLIST */
-        }
-    for (index = 0; index < HSIZE; index++)
-        for (cl = p->centers[index]; cl; cl = clnext) {
-            clnext = cl->next;
-            free((char *) cl);          /* free CENTERLIST */
-        }
-    for (index = 0; index < 2*HSIZE; index++)
-        for (edge = p->edges[index]; edge; edge = edgenext) {
-            edgenext = edge->next;
-            free((char *) edge);        /* free EDGELIST */
-        }
-    free((char *) p->edges);            /* free array EDGELIST ptrs */
-    free((char *) p->corners);          /* free array CORNERLIST ptrs */
-    free((char *) p->centers);          /* free array CENTERLIST ptrs */
+    htfree(&p->centers);
+    htfree(&p->corners);
+    htfree(&p->edges);
+    free((char *) p->cubes);
+    free((char *) p->cornerbuf);
     if (p->vertices.ptr)
         free((char *) p->vertices.ptr); /* free VERTEX array */
 }
@@ -600,36 +610,37 @@ void testface (
     int face, int c1, int c2, int c3, int c4,   PROCESS *p)
     {
     CUBE cubeNew;
-    CUBES *oldcubes = p->cubes;
     static int facebit[6] = {2, 2, 1, 1, 0, 0};
-    int n, pos = old->corners[c1]->value > 0.0 ? 1 : 0;
+    int n, pos = p->cornerbuf[old->corners[c1]].value > 0.0 ? 1 : 0;
     int bit = facebit[face];
 
     /* test if  no surface crossing, cube out of bounds, or prev. visited? */
-    if ((old->corners[c2]->value > 0) == pos &&
-        (old->corners[c3]->value > 0) == pos &&
-        (old->corners[c4]->value > 0) == pos) return;
+    if ((p->cornerbuf[old->corners[c2]].value > 0) == pos &&
+        (p->cornerbuf[old->corners[c3]].value > 0) == pos &&
+        (p->cornerbuf[old->corners[c4]].value > 0) == pos) return;
     if (abs(i) > p->bounds || abs(j) > p->bounds || abs(k) > p->bounds)
         return;
-    if (setcenter(p->centers, i, j, k)) return;
+    if (setcenter(p, i, j, k)) return;
 
     /* create new cube: */
     cubeNew.i = i;
     cubeNew.j = j;
     cubeNew.k = k;
-    for (n = 0; n < 8; n++) cubeNew.corners[n] = NULL;
+    for (n = 0; n < 8; n++) cubeNew.corners[n] = -1;
     cubeNew.corners[FLIP(c1, bit)] = old->corners[c1];
     cubeNew.corners[FLIP(c2, bit)] = old->corners[c2];
     cubeNew.corners[FLIP(c3, bit)] = old->corners[c3];
     cubeNew.corners[FLIP(c4, bit)] = old->corners[c4];
     for (n = 0; n < 8; n++)
-        if (cubeNew.corners[n] == NULL) cubeNew.corners[n] =
+        if (cubeNew.corners[n] < 0) cubeNew.corners[n] =
             setcorner(p, i+BIT(n,2), j+BIT(n,1), k+BIT(n,0));
 
     /*add cube to top of stack: */
-    p->cubes = (CUBES *) mycalloc(1, sizeof(CUBES));
-    p->cubes->cube = cubeNew;
-    p->cubes->next = oldcubes;
+    if (p->ncubes == p->maxcubes) {
+        p->maxcubes *= 2;
+        p->cubes = (CUBE *) myrealloc((char *) p->cubes, p->maxcubes, sizeof(CUBE));
+    }
+    p->cubes[p->ncubes++] = cubeNew;
 }
 
 
@@ -644,25 +655,29 @@ void setpoint (R3Pt &out_pt, int i, int j, int k, PROCESS *p)
 }
 
 
-/* setcorner: return corner with the given lattice location
+/* setcorner: return (the index of) corner with the given lattice location
    set (and cache) its function value */
 
-CORNERLIST *setcorner (PROCESS *p, int i, int j, int k) {
+int setcorner (PROCESS *p, int i, int j, int k) {
     /* for speed, do corner value caching here */
-    int index = HASH(i, j, k);
-    CORNERLIST *l = p->corners[index];
+    unsigned long long key = latticekey(i, j, k);
+    int index = htget(&p->corners, key);
+    CORNER *l;
     R3Pt pt;
-    
-    for (; l != NULL; l = l->next)
-        if (l->i == i && l->j == j && l->k == k) return l;
-            
+
+    if (index >= 0) return index;
+
     setpoint (pt, i, j, k, p);
-    l = (CORNERLIST *) mycalloc(1, sizeof(CORNERLIST));
+    if (p->ncorners == p->maxcorners) {
+        p->maxcorners *= 2;
+        p->cornerbuf = (CORNER *) myrealloc((char *) p->cornerbuf, p->maxcorners, sizeof(CORNER));
+    }
+    index = p->ncorners++;
+    l = &p->cornerbuf[index];
     l->i = i; l->j = j; l->k = k;
-    l->value = p->function(pt);
-    l->next = p->corners[index];
-    p->corners[index] = l;
-    return l;
+    l->value = p->function(pt, p->fdata);
+    htput(&p->corners, key, index);
+    return index;
 }
 
 
@@ -681,7 +696,7 @@ TEST find (int sign, PROCESS *p, const R3Pt &in_pt)
         test.p = in_pt + vec;
 
 
-        test.value = p->function(test.p);
+        test.value = p->function(test.p, p->fdata);
         if (sign == (test.value > 0.0)) return test;
         range = range*1.0005; /* slowly expand search outwards */
     }
@@ -698,10 +713,10 @@ TEST find (int sign, PROCESS *p, const R3Pt &in_pt)
  * return 0 if client aborts, 1 otherwise */
 
 int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p) {
-    CORNERLIST *a = cube->corners[c1];
-    CORNERLIST *b = cube->corners[c2];
-    CORNERLIST *c = cube->corners[c3];
-    CORNERLIST *d = cube->corners[c4];
+    CORNER *a = &p->cornerbuf[cube->corners[c1]];
+    CORNER *b = &p->cornerbuf[cube->corners[c2]];
+    CORNER *c = &p->cornerbuf[cube->corners[c3]];
+    CORNER *d = &p->cornerbuf[cube->corners[c4]];
     int index = 0, apos, bpos, cpos, dpos, e1, e2, e3, e4, e5, e6;
     if (apos = (a->value > 0.0)) index += 8;
     if (bpos = (b->value > 0.0)) index += 4;
@@ -748,63 +763,130 @@ int dotet (CUBE *cube, int c1, int c2, int c3, int c4, PROCESS *p) {
 
 char *mycalloc (int nitems, int nbytes) {
    char *ptr = (char *) calloc(nitems, nbytes);
+   n_allocations++;
    if (ptr != NULL) return ptr;
    fprintf(stderr, "can't calloc %d bytes\n", nitems*nbytes);
    exit(1);
 }
 
 
-/* setcenter: set (i,j,k) entry of table[]
+/* myrealloc: return successful realloc to nitems or exit program */
+
+char *myrealloc (char *ptr, int nitems, int nbytes) {
+   char *ptrNew = (char *) realloc(ptr, (size_t)nitems*nbytes);
+   n_allocations++;
+   if (ptrNew != NULL) return ptrNew;
+   fprintf(stderr, "can't realloc %d bytes\n", nitems*nbytes);
+   exit(1);
+}
+
+
+/* latticekey: lattice location packed in 64 bits, 21 bits per axis, never 0 */
+
+unsigned long long latticekey (int i, int j, int k) {
+    return ((unsigned long long)(i+(1<<20))<<42) |
+           ((unsigned long long)(j+(1<<20))<<21) | (unsigned long long)(k+(1<<20));
+}
+
+
+/* htinit: empty table of 2^bits slots */
+
+void htinit (HTABLE *table, int bits) {
+    table->bits = bits;
+    table->count = 0;
+    table->keys = (unsigned long long *) mycalloc(1<<bits, sizeof(unsigned long long));
+    table->values = (int *) mycalloc(1<<bits, sizeof(int));
+}
+
+void htfree (HTABLE *table) {
+    free((char *) table->keys);
+    free((char *) table->values);
+}
+
+
+/* htslot: slot of key, or the empty slot where it would go */
+
+int htslot (const HTABLE *table, unsigned long long key) {
+    unsigned int mask = (1u<<table->bits)-1;
+    unsigned int index = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> (64-table->bits));
+    while (table->keys[index] != 0 && table->keys[index] != key) index = (index+1) & mask;
+    return index;
+}
+
+
+/* htget: value of key, -1 if not set */
+
+int htget (const HTABLE *table, unsigned long long key) {
+    int index = htslot(table, key);
+    return table->keys[index] == key ? table->values[index] : -1;
+}
+
+
+/* htput: set the value of key, doubling the table when half full */
+
+void htput (HTABLE *table, unsigned long long key, int value) {
+    int index;
+    if (2*(table->count+1) > (1<<table->bits)) {
+        HTABLE tableNew;
+        int n;
+        htinit(&tableNew, table->bits+1);
+        for (n = 0; n < (1<<table->bits); n++)
+            if (table->keys[n] != 0) {
+                index = htslot(&tableNew, table->keys[n]);
+                tableNew.keys[index] = table->keys[n];
+                tableNew.values[index] = table->values[n];
+            }
+        tableNew.count = table->count;
+        htfree(table);
+        *table = tableNew;
+    }
+    index = htslot(table, key);
+    if (table->keys[index] == 0) table->count++;
+    table->keys[index] = key;
+    table->values[index] = value;
+}
+
+
+/* setcenter: set (i,j,k) entry of the center table
  * return 1 if already set; otherwise, set and return 0 */
 
-int setcenter(CENTERLIST *table[], int i, int j, int k) {
-    int index = HASH(i, j, k);
-    CENTERLIST *centerListNew, *l, *q = table[index];
-    for (l = q; l != NULL; l = l->next)
-        if (l->i == i && l->j == j && l->k == k) return 1;
-    centerListNew = (CENTERLIST *) mycalloc(1, sizeof(CENTERLIST));
-    centerListNew->i = i; centerListNew->j = j; centerListNew->k = k; centerListNew->next = q;
-    table[index] = centerListNew;
+int setcenter(PROCESS *p, int i, int j, int k) {
+    unsigned long long key = latticekey(i, j, k);
+    if (htget(&p->centers, key) >= 0) return 1;
+    htput(&p->centers, key, 1);
     return 0;
 }
 
 
+/* edgekey: edge packed in 64 bits, the lexicographically smaller corner with LATTICEBITS per axis
+ * and the offset to the other corner, one of 27 */
+
+unsigned long long edgekey (int i1, int j1, int k1, int i2, int j2, int k2) {
+    const int off = 1<<(LATTICEBITS-1);
+    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
+        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
+    }
+    return ((((unsigned long long)(i1+off)<<LATTICEBITS | (unsigned long long)(j1+off))<<LATTICEBITS
+             | (unsigned long long)(k1+off))<<5) | (unsigned long long)((i2-i1+1)*9 + (j2-j1+1)*3 + (k2-k1+1) + 1);
+}
+
+
 /* setedge: set vertex id for edge */
 
 void setedge (
-    EDGELIST *table[],
+    PROCESS *p,
     int i1, int j1, int k1, int i2, int j2, int k2, int vid)
     {
-    unsigned int index;
-    EDGELIST *edgeListNew;
-    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
-        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
-    }
-    index = HASH(i1, j1, k1) + HASH(i2, j2, k2);
-    edgeListNew = (EDGELIST *) mycalloc(1, sizeof(EDGELIST));
-    edgeListNew->i1 = i1; edgeListNew->j1 = j1; edgeListNew->k1 = k1;
-    edgeListNew->i2 = i2; edgeListNew->j2 = j2; edgeListNew->k2 = k2;
-    edgeListNew->vid = vid;
-    edgeListNew->next = table[index];
-    table[index] = edgeListNew;
+    htput(&p->edges, edgekey(i1, j1, k1, i2, j2, k2), vid);
 }
 
 
 /* getedge: return vertex id for edge; return -1 if not set */
 
-int getedge (EDGELIST *table[],
+int getedge (PROCESS *p,
              int i1, int j1, int k1, int i2, int j2, int k2)
     {
-    EDGELIST *q;
-    if (i1>i2 || (i1==i2 && (j1>j2 || (j1==j2 && k1>k2)))) {
-        int t=i1; i1=i2; i2=t; t=j1; j1=j2; j2=t; t=k1; k1=k2; k2=t;
-    }
-    q = table[HASH(i1, j1, k1)+HASH(i2, j2, k2)];
-    for (; q != NULL; q = q->next)
-        if (q->i1 == i1 && q->j1 == j1 && q->k1 == k1 &&
-            q->i2 == i2 && q->j2 == j2 && q->k2 == k2)
-            return q->vid;
-    return -1;
+    return htget(&p->edges, edgekey(i1, j1, k1, i2, j2, k2));
 }
 
 
@@ -819,18 +901,19 @@ void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_v);
  * c1->value and c2->value are presumed of different sign
  * return saved index if any; else compute vertex and save */
 
-int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p) {
+int vertid (CORNER *c1, CORNER *c2, PROCESS *p) {
     VERTEX v;
     R3Pt a, b;
     int vid =
-        getedge(p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k);
+        getedge(p, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k);
     if (vid != -1) return vid;                /* previously computed */
     setpoint (a, c1->i, c1->j, c1->k, p);
     setpoint (b, c2->i, c2->j, c2->k, p);
-    converge (a, b, c1->value, p->function, v.position); /* posn.  */
+    converge (a, b, c1->value, c2->value, p->function, p->gradfunction, p->fdata,
+              p->tolerance, v.position);                      /* posn.  */
     vnormal(v.position, p, v.normal);                     /* normal */
     vid = addtovertices(&p->vertices, v);                   /* save   */
-    setedge(p->edges, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k, vid);
+    setedge(p, c1->i, c1->j, c1->k, c2->i, c2->j, c2->k, vid);
     return vid;
 }
 
@@ -839,13 +922,8 @@ int vertid (CORNERLIST *c1, CORNERLIST *c2, PROCESS *p) {
 
 int addtovertices (VERTICES *vertices, VERTEX v) {
    if (vertices->count == vertices->max) {
-      int i;
-      VERTEX *vertexNew;
-      vertices->max = vertices->count == 0 ? 10 : 2*vertices->count;
-      vertexNew = (VERTEX *) mycalloc((unsigned)vertices->max,sizeof(VERTEX));
-      for (i = 0; i < vertices->count; i++) vertexNew[i] = vertices->ptr[i];
-      if (vertices->ptr != NULL) free((char *) vertices->ptr);
-      vertices->ptr = vertexNew;
+      vertices->max = vertices->count == 0 ? 1024 : 2*vertices->count;
+      vertices->ptr = (VERTEX *) myrealloc((char *) vertices->ptr, vertices->max, sizeof(VERTEX));
    }
    vertices->ptr[vertices->count++] = v;
    return (vertices->count-1);
@@ -855,7 +933,13 @@ int addtovertices (VERTICES *vertices, VERTEX v) {
 /* vnormal: compute unit length surface normal at point */
 
 void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_vec) {
-    const double f = p->function(in_point);
+    if (p->gradfunction) {
+        p->gradfunction(in_point, p->fdata, out_vec);
+        out_vec = UnitSafe( out_vec );
+        return;
+    }
+
+    const double f = p->function(in_point, p->fdata);
 
 
 
@@ -865,7 +949,7 @@ void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_vec) {
 
         vec[i] = p->delta;
 
-        out_vec[i] = p->function( in_point + vec ) - f;
+        out_vec[i] = p->function( in_point + vec, p->fdata ) - f;
 
         vec[i] = 0.0;
 
@@ -878,36 +962,85 @@ void vnormal (const R3Pt &in_point, PROCESS *p, R3Vec &out_vec) {
 }
 
 
-/* converge: from two points of differing sign, converge to surface */
-
-void converge ( const R3Pt &in_p1, const R3Pt &in_p2, double v,
-                double (*function)(const R3Pt &in_pt), 
+/* converge: from two points of differing sign, converge to surface
+ * v1, v2: function values at in_p1, in_p2
+ * tolerance <= 0: RES bisection steps
+ * otherwise: start from the linear interpolation of v1 and v2 and keep a bracket of the root; step
+ *   with Newton along the segment when gradfunction is given and the step stays in the bracket, with
+ *   Illinois (regula falsi, halving the value of an end kept twice) else; stop when the step or the
+ *   bracket is below tolerance, a distance */
 
-                R3Pt &out_p)
+void converge ( const R3Pt &in_p1, const R3Pt &in_p2, double v1, double v2,
+                double (*function)(const R3Pt &in_pt, void *fdata),
+                double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+                void *fdata, double tolerance, R3Pt &out_p)
 {
     int i = 0;
-    R3Pt pos, neg;
-    if (v < 0) {
+    if (tolerance <= 0.0) {
+        R3Pt pos, neg;
+        if (v1 < 0) {
 
-        pos = in_p2;
+            pos = in_p2;
 
-        neg = in_p1;
+            neg = in_p1;
 
-    }
-    else {
-        pos = in_p1;
+        }
+        else {
+            pos = in_p1;
+
+            neg = in_p2;
+
+        }
+        for (;;) {
+
+            out_p = Lerp( pos, neg, 0.5 );
 
-        neg = in_p2;
 
+            if (i++ == RES) return;
+            if ((function(out_p, fdata)) > 0.0)
+                 {pos = out_p;}
+            else {neg = out_p;}
+        }
     }
-    for (;;) {
 
-        out_p = Lerp( pos, neg, 0.5 );
+    const R3Vec dir = in_p2 - in_p1;
+    const double len = Length(dir);
+    if (len == 0.0 || v1 == v2) {
+        out_p = in_p1;
+        return;
+    }
+    const double eps = tolerance / len;            /* tolerance in segment parameter */
+    const int poslo = v1 > 0.0;
+    double lo = 0.0, hi = 1.0, flo = v1, fhi = v2;  /* bracket [lo,hi] */
+    double t = v1 / (v1 - v2);
+    int side = 0;
+    for (i = 0; i < MAXITER; i++) {
+        double f, df = 0.0, tn = -1.0;
+        out_p = in_p1 + dir * t;
+        if (gradfunction) {
+            R3Vec grad;
+            f = gradfunction(out_p, fdata, grad);
+            df = Dot(grad, dir);
+        }
+        else f = function(out_p, fdata);
+        if (f == 0.0) return;
 
+        if ((f > 0.0) == poslo) {
+            lo = t; flo = f;
+            if (side == -1) fhi *= 0.5;
+            side = -1;
+        }
+        else {
+            hi = t; fhi = f;
+            if (side == 1) flo *= 0.5;
+            side = 1;
+        }
 
-        if (i++ == RES) return;
-        if ((function((out_p))) > 0.0)
-             {pos = out_p;}
-        else {neg = out_p;}
+        if (df != 0.0) tn = t - f / df;
+        if (!(tn > lo && tn < hi)) tn = (lo * fhi - hi * flo) / (fhi - flo);
+        const int done = fabs(tn - t) < eps || hi - lo < eps;
+        t = tn;
+        if (done) break;
     }
+    out_p = in_p1 + dir * t;
 }
@@ -0,0 +1,451 @@
+#include "PolygonizerAdaptive.h"
+#include <algorithm>
+#include <cmath>
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+#define BIT(i, bit) (((i)>>(bit))&1)
+
+/* in polygonizer.cpp */
+void converge ( const R3Pt &in_p1, const R3Pt &p2, double v1, double v2,
+                double (*function)(const R3Pt &in_pt, void *fdata),
+                double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+                void *fdata, double tolerance, R3Pt &p);
+
+namespace{
+
+/* crossing point of an edge, with the unit normal */
+struct Hermite{
+    R3Pt p;
+    R3Vec n;
+};
+
+/* edge of a level: lattice point x, y, z and axis, key = CornerKey << 2 | axis */
+struct EdgeRec{
+    unsigned long long key;
+    int c[3], axis;
+    bool operator<(const EdgeRec &e)const{ return key<e.key; }
+    bool operator==(const EdgeRec &e)const{ return key==e.key; }
+};
+
+/* the 12 edges of a cube, corner n1 to corner n2 = n1 | bit, along axis 2 - log2(bit) */
+static const int CUBE_EDGES[12][3] = {
+    {0,4,0},{1,5,0},{2,6,0},{3,7,0},
+    {0,2,1},{1,3,1},{4,6,1},{5,7,1},
+    {0,1,2},{2,3,2},{4,5,2},{6,7,2}
+};
+
+/* eigen decomposition of the symmetric matrix a (destroyed) by Jacobi rotations: a = v diag(w) v^T */
+void Eigen3(double a[3][3], double w[3], double v[3][3]){
+
+    for(int i=0;i<3;++i)for(int j=0;j<3;++j)v[i][j] = i==j;
+    for(int sweep=0;sweep<32;++sweep){
+        double off = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+        double diag = a[0][0]*a[0][0] + a[1][1]*a[1][1] + a[2][2]*a[2][2];
+        if(off <= 1e-30*diag)break;
+        for(int p=0;p<2;++p)for(int q=p+1;q<3;++q){
+            if(a[p][q]==0)continue;
+            double theta = (a[q][q]-a[p][p]) / (2*a[p][q]);
+            double t = (theta>=0 ? 1 : -1) / (fabs(theta)+sqrt(theta*theta+1));
+            double c = 1/sqrt(t*t+1), s = t*c;
+            for(int k=0;k<3;++k){
+                double akp = a[k][p], akq = a[k][q];
+                a[k][p] = c*akp - s*akq;
+                a[k][q] = s*akp + c*akq;
+            }
+            for(int k=0;k<3;++k){
+                double apk = a[p][k], aqk = a[q][k];
+                a[p][k] = c*apk - s*aqk;
+                a[q][k] = s*apk + c*aqk;
+            }
+            for(int k=0;k<3;++k){
+                double vkp = v[k][p], vkq = v[k][q];
+                v[k][p] = c*vkp - s*vkq;
+                v[k][q] = s*vkp + c*vkq;
+            }
+        }
+    }
+    for(int i=0;i<3;++i)w[i] = a[i][i];
+}
+
+/* minimizer of sum (n_i . (x - p_i))^2 closest to the mass point of the p_i, the directions of the
+ * eigenvalues below 1% of the largest one are left at the mass point; x is clamped to [lo, lo+h]
+ * returns the mean squared distance of x to the planes */
+double Solve_QEF(const vector<const Hermite*> &hs, const double lo[3], double h, double x[3]){
+
+    const int k = hs.size();
+    double m[3] = {0,0,0};
+    for(auto he:hs)for(int t=0;t<3;++t)m[t] += he->p[t] / k;
+
+    double ata[3][3] = {{0,0,0},{0,0,0},{0,0,0}}, atb[3] = {0,0,0};
+    for(auto he:hs){
+        const R3Vec &n = he->n;
+        double b = n[0]*(he->p[0]-m[0]) + n[1]*(he->p[1]-m[1]) + n[2]*(he->p[2]-m[2]);
+        for(int i=0;i<3;++i){
+            for(int j=0;j<3;++j)ata[i][j] += n[i]*n[j];
+            atb[i] += n[i]*b;
+        }
+    }
+    double w[3], v[3][3];
+    Eigen3(ata, w, v);
+    double wmax = max(w[0], max(w[1], w[2]));
+    for(int t=0;t<3;++t)x[t] = m[t];
+    for(int j=0;j<3;++j){
+        if(w[j] <= 0.01*wmax)continue;
+        double d = (v[0][j]*atb[0] + v[1][j]*atb[1] + v[2][j]*atb[2]) / w[j];
+        for(int t=0;t<3;++t)x[t] += d * v[t][j];
+    }
+    for(int t=0;t<3;++t)x[t] = min(max(x[t], lo[t]), lo[t]+h);
+
+    double res = 0;
+    for(auto he:hs){
+        double d = 0;
+        for(int t=0;t<3;++t)d += he->n[t] * (x[t]-he->p[t]);
+        res += d*d;
+    }
+    return res / k;
+}
+
+}
+
+
+AdaptivePolygonizer::AdaptivePolygonizer(FUNCTION function, void *fdata, GRADFUNCTION gradfunction,
+                                         double size, int bounds, double error, double tolerance, const R3Pt &start):
+    function(function),gradfunction(gradfunction),fdata(fdata),size(size),error(error),tolerance(tolerance),start(start){
+
+    /* root cube of 2^depth cubes of size, at least bounds on each side of start */
+    depth = 1;
+    while(depth<15 && (1<<(depth-1)) < bounds)++depth;
+}
+
+void AdaptivePolygonizer::SetPoint(R3Pt &out_pt, int x, int y, int z) const{
+
+    const int half = 1<<(depth-1);
+    out_pt[0] = start[0] + (double)(x-half) * size;
+    out_pt[1] = start[1] + (double)(y-half) * size;
+    out_pt[2] = start[2] + (double)(z-half) * size;
+}
+
+const AdaptivePolygonizer::Corner &AdaptivePolygonizer::Corner_At(int x, int y, int z) const{
+
+    return corners.find(CornerKey(x, y, z))->second;
+}
+
+/* the corners of the cells not evaluated yet, as one parallel batch */
+void AdaptivePolygonizer::Eval_Corners(const vector<int> &cells){
+
+    vector<unsigned long long> keys;
+    vector<R3Pt> points;
+    for(int ci:cells){
+        const Node &c = nodes[ci];
+        const int s = 1<<(depth-c.level);
+        for(int n=0;n<8;++n){
+            int x = c.x+BIT(n,2)*s, y = c.y+BIT(n,1)*s, z = c.z+BIT(n,0)*s;
+            unsigned long long key = CornerKey(x, y, z);
+            if(!corners.emplace(key, Corner()).second)continue;
+            keys.push_back(key);
+            points.push_back(R3Pt());
+            SetPoint(points.back(), x, y, z);
+        }
+    }
+    const long long nk = keys.size();
+    vector<Corner> batch(nk);
+#pragma omp parallel for schedule(dynamic,64)
+    for(long long t=0;t<nk;++t){
+        R3Vec g;
+        batch[t].value = gradfunction(points[t], fdata, g);
+        for(int k=0;k<3;++k)batch[t].grad[k] = g[k];
+    }
+    for(long long t=0;t<nk;++t)corners[keys[t]] = batch[t];
+}
+
+/* does the tangent plane of a corner, the linear model of the function there, vanish in the cell */
+bool AdaptivePolygonizer::Tangent_Crosses(const Node &c) const{
+
+    const int s = 1<<(depth-c.level);
+    const double h = s * size;
+    for(int n=0;n<8;++n){
+        const Corner &co = Corner_At(c.x+BIT(n,2)*s, c.y+BIT(n,1)*s, c.z+BIT(n,0)*s);
+        double lo = co.value, hi = co.value;
+        for(int k=0;k<3;++k){
+            double d = (BIT(n,2-k) ? -h : h) * co.grad[k];
+            if(d<0)lo += d;
+            else hi += d;
+        }
+        if(co.value > 0.0 ? lo <= 0.0 : hi > 0.0)return true;
+    }
+    return false;
+}
+
+void AdaptivePolygonizer::Build(){
+
+    const int mindepth = min(depth, (int)MINDEPTH);
+    const double edgetol = (tolerance > 0.0 ? tolerance : 1e-3*size);
+
+    Node root = {0, 0, 0, 0, false, -1};
+    nodes.push_back(root);
+    nodeindex[NodeKey(0,0,0,0)] = 0;
+    vector<int> cur(1, 0);
+
+    for(int l=0;!cur.empty();++l){
+        const int s = 1<<(depth-l);
+        const double h = s * size;
+        Eval_Corners(cur);
+
+        /* crossed edges of the level, each converged once */
+        vector<EdgeRec> edges;
+        for(int ci:cur){
+            const Node &c = nodes[ci];
+            for(int e=0;e<12;++e){
+                int n1 = CUBE_EDGES[e][0], n2 = CUBE_EDGES[e][1];
+                int a[3] = {c.x+BIT(n1,2)*s, c.y+BIT(n1,1)*s, c.z+BIT(n1,0)*s};
+                int b[3] = {c.x+BIT(n2,2)*s, c.y+BIT(n2,1)*s, c.z+BIT(n2,0)*s};
+                if((Corner_At(a[0],a[1],a[2]).value > 0.0) == (Corner_At(b[0],b[1],b[2]).value > 0.0))continue;
+                EdgeRec er;
+                er.key = CornerKey(a[0],a[1],a[2])<<2 | CUBE_EDGES[e][2];
+                for(int t=0;t<3;++t)er.c[t] = a[t];
+                er.axis = CUBE_EDGES[e][2];
+                edges.push_back(er);
+            }
+        }
+        sort(edges.begin(), edges.end());
+        edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+        const long long nedge = edges.size();
+        vector<Hermite> hermite(nedge);
+#pragma omp parallel for schedule(dynamic,64)
+        for(long long e=0;e<nedge;++e){
+            int b[3] = {edges[e].c[0], edges[e].c[1], edges[e].c[2]};
+            b[edges[e].axis] += s;
+            R3Pt pa, pb;
+            SetPoint(pa, edges[e].c[0], edges[e].c[1], edges[e].c[2]);
+            SetPoint(pb, b[0], b[1], b[2]);
+            converge(pa, pb, Corner_At(edges[e].c[0], edges[e].c[1], edges[e].c[2]).value,
+                     Corner_At(b[0], b[1], b[2]).value, function, gradfunction, fdata, edgetol, hermite[e].p);
+            gradfunction(hermite[e].p, fdata, hermite[e].n);
+            hermite[e].n = UnitSafe(hermite[e].n);
+        }
+
+        /* split or leaf, and the vertex of the crossed leaves */
+        const long long ncur = cur.size();
+        vector<char> split(ncur, 0), hasvertex(ncur, 0);
+        vector<VERTEX> cellvertex(ncur);
+#pragma omp parallel for schedule(dynamic,16)
+        for(long long t=0;t<ncur;++t){
+            const Node &c = nodes[cur[t]];
+            vector<const Hermite*> hs;
+            for(int e=0;e<12;++e){
+                int n1 = CUBE_EDGES[e][0];
+                EdgeRec er;
+                er.key = CornerKey(c.x+BIT(n1,2)*s, c.y+BIT(n1,1)*s, c.z+BIT(n1,0)*s)<<2 | CUBE_EDGES[e][2];
+                auto it = lower_bound(edges.begin(), edges.end(), er);
+                if(it!=edges.end() && it->key==er.key)hs.push_back(&hermite[it-edges.begin()]);
+            }
+            if(hs.empty()){
+                split[t] = l<mindepth || (l<depth && Tangent_Crosses(c));
+                continue;
+            }
+
+            R3Pt lo;
+            SetPoint(lo, c.x, c.y, c.z);
+            double x[3], lop[3] = {lo[0], lo[1], lo[2]};
+            double res = Solve_QEF(hs, lop, h, x);
+            VERTEX &v = cellvertex[t];
+            v.position = R3Pt(x[0], x[1], x[2]);
+            double f = gradfunction(v.position, fdata, v.normal);
+            double gn = Length(v.normal);
+            v.normal = UnitSafe(v.normal);
+            hasvertex[t] = 1;
+
+            /* distance of the vertex to the surface, to the planes, and sagitta of the normal spread */
+            double mindot = 1;
+            for(size_t i=0;i<hs.size();++i)for(size_t j=i+1;j<hs.size();++j)mindot = min(mindot, Dot(hs[i]->n, hs[j]->n));
+            double dist = gn>0 ? fabs(f)/gn : h;
+            double err = max(dist, max(sqrt(res), h * acos(max(-1.0, mindot)) / 8));
+            split[t] = l<mindepth || (l<depth && err > error);
+        }
+
+        vector<int> next;
+        for(long long t=0;t<ncur;++t){
+            if(!split[t]){
+                nodes[cur[t]].leaf = true;
+                ++n_leaves;
+                if(hasvertex[t]){
+                    nodes[cur[t]].vertex = verts.size();
+                    verts.push_back(cellvertex[t]);
+                }
+                continue;
+            }
+            const Node c = nodes[cur[t]];   // nodes grows below
+            const int half = s/2;
+            for(int n=0;n<8;++n){
+                Node ch = {l+1, c.x+BIT(n,2)*half, c.y+BIT(n,1)*half, c.z+BIT(n,0)*half, false, -1};
+                nodeindex[NodeKey(ch.level, ch.x, ch.y, ch.z)] = nodes.size();
+                next.push_back(nodes.size());
+                nodes.push_back(ch);
+            }
+        }
+        cur.swap(next);
+    }
+    n_corners = corners.size();
+}
+
+int AdaptivePolygonizer::Locate(int level, const long long p2[3]) const{
+
+    const long long lim = 2LL<<depth;
+    for(int t=0;t<3;++t)if(p2[t]<0 || p2[t]>=lim)return -1;
+    for(int l=level;l>=0;--l){
+        const int sh = depth-l+1;
+        auto it = nodeindex.find(NodeKey(l, (int)((p2[0]>>sh)<<(sh-1)), (int)((p2[1]>>sh)<<(sh-1)), (int)((p2[2]>>sh)<<(sh-1))));
+        if(it!=nodeindex.end())return it->second;
+    }
+    return -1;
+}
+
+void AdaptivePolygonizer::Center_Vertex(const Node &c, VERTEX &v) const{
+
+    const int s = 1<<(depth-c.level);
+    R3Pt lo, center;
+    SetPoint(lo, c.x, c.y, c.z);
+    SetPoint(center, c.x, c.y, c.z);
+    for(int k=0;k<3;++k)center[k] += 0.5 * s * size;
+    R3Vec g;
+    double f = gradfunction(center, fdata, g);
+    double g2 = Dot(g, g);
+    v.position = center;
+    if(g2>0)for(int k=0;k<3;++k)v.position[k] = min(max(center[k] - f*g[k]/g2, lo[k]), lo[k] + s*size);
+    gradfunction(v.position, fdata, v.normal);
+    v.normal = UnitSafe(v.normal);
+}
+
+void AdaptivePolygonizer::Contour(vector<VERTEX> &vertices, vector<int> &triangles){
+
+    /* the quadrants around an edge along axis a, counterclockwise around +a, in the axes a+1, a+2 */
+    static const int QUADRANT[4][2] = {{-1,-1},{1,-1},{1,1},{-1,1}};
+
+    /* polygons (4 leaves) around the minimal crossed edges, per leaf in node order */
+    const long long nnode = nodes.size();
+    vector<vector<int>> polygons(nnode);
+#pragma omp parallel for schedule(dynamic,64)
+    for(long long ni=0;ni<nnode;++ni){
+        const Node &c = nodes[ni];
+        if(!c.leaf)continue;
+        const int s = 1<<(depth-c.level);
+        for(int e=0;e<12;++e){
+            int n1 = CUBE_EDGES[e][0], n2 = CUBE_EDGES[e][1], a = CUBE_EDGES[e][2];
+            const int p1[3] = {c.x+BIT(n1,2)*s, c.y+BIT(n1,1)*s, c.z+BIT(n1,0)*s};
+            double v1 = Corner_At(p1[0],p1[1],p1[2]).value;
+            double v2 = Corner_At(c.x+BIT(n2,2)*s, c.y+BIT(n2,1)*s, c.z+BIT(n2,0)*s).value;
+            if((v1 > 0.0) == (v2 > 0.0))continue;
+
+            int quad[4], first = -1;
+            bool minimal = true;
+            for(int q=0;q<4 && minimal;++q){
+                long long p2[3];
+                p2[a] = 2*(long long)p1[a] + 1;
+                p2[(a+1)%3] = 2*(long long)p1[(a+1)%3] + QUADRANT[q][0];
+                p2[(a+2)%3] = 2*(long long)p1[(a+2)%3] + QUADRANT[q][1];
+                quad[q] = Locate(c.level, p2);
+                /* outside the root, or a smaller leaf around the edge */
+                if(quad[q]<0 || !nodes[quad[q]].leaf)minimal = false;
+                else if(first<0 && nodes[quad[q]].level==c.level)first = quad[q];
+            }
+            if(!minimal || first!=ni)continue;
+
+            /* counterclockwise around +a if the surface normal is along +a */
+            if(v1 > 0.0)swap(quad[1], quad[3]);
+            for(int q=0;q<4;++q)polygons[ni].push_back(quad[q]);
+        }
+    }
+
+    /* vertex ids in node order, leaves without crossed edge get the projection of their center */
+    vector<int> vid(nnode, -1);
+    vector<int> centers;
+    for(auto &poly:polygons)for(int ni:poly)vid[ni] = 0;
+    int nv = 0;
+    for(long long ni=0;ni<nnode;++ni){
+        if(vid[ni]<0)continue;
+        vid[ni] = nv++;
+        if(nodes[ni].vertex<0)centers.push_back(ni);
+    }
+    vertices.resize(nv);
+    const int ncenter = centers.size();
+#pragma omp parallel for schedule(dynamic,16)
+    for(int t=0;t<ncenter;++t)Center_Vertex(nodes[centers[t]], vertices[vid[centers[t]]]);
+    for(long long ni=0;ni<nnode;++ni)
+        if(vid[ni]>=0 && nodes[ni].vertex>=0)vertices[vid[ni]] = verts[nodes[ni].vertex];
+
+    /* quads split along the shorter diagonal, repeated leaves (next to a larger leaf) make triangles;
+     * emitted in the order of polygonize, clockwise seen from the positive side */
+    for(auto &poly:polygons){
+        for(size_t pi=0;pi<poly.size();pi+=4){
+            int q[4], m = 0;
+            for(int t=0;t<4;++t){
+                int v = vid[poly[pi+t]];
+                if(m==0 || (v!=q[m-1] && (t<3 || v!=q[0])))q[m++] = v;
+            }
+            if(m==3){
+                triangles.push_back(q[2]); triangles.push_back(q[1]); triangles.push_back(q[0]);
+            }else if(m==4){
+                if(Length(vertices[q[0]].position - vertices[q[2]].position) <= Length(vertices[q[1]].position - vertices[q[3]].position)){
+                    triangles.push_back(q[2]); triangles.push_back(q[1]); triangles.push_back(q[0]);
+                    triangles.push_back(q[3]); triangles.push_back(q[2]); triangles.push_back(q[0]);
+                }else{
+                    triangles.push_back(q[3]); triangles.push_back(q[1]); triangles.push_back(q[0]);
+                    triangles.push_back(q[3]); triangles.push_back(q[2]); triangles.push_back(q[1]);
+                }
+            }
+        }
+    }
+}
+
+
+/* polygonize_adaptive: see Polygonizer.h and AdaptivePolygonizer */
+
+bool polygonize_adaptive (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double error,
+    double tolerance,
+    const R3Pt &in_pt,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices))
+{
+    if(!gradfunction){
+        cerr << "ERR: polyganizer adaptive surfacing needs the gradient\n";
+        return false;
+    }
+
+    AdaptivePolygonizer ap(function, fdata, gradfunction, size, bounds, error*size,
+                           tolerance > 0.0 ? tolerance*size : 0.0, in_pt);
+    ap.Build();
+
+    vector<VERTEX> vs;
+    vector<int> tris;
+    ap.Contour(vs, tris);
+    printf("adaptive polygonize: depth %d, %d leaves, %d corners, %d vertices, %d triangles\n",
+           ap.depth, ap.n_leaves, ap.n_corners, (int)vs.size(), (int)tris.size()/3);
+    if(tris.empty()){
+        cerr << "ERR: polyganizer no leaf is crossed by the surface\n";
+        return false;
+    }
+
+    VERTICES vertices;
+    vertices.count = vertices.max = vs.size();
+    vertices.ptr = vs.data();
+    for(size_t t=0;t<tris.size();t+=3)
+        if(!triproc(tris[t], tris[t+1], tris[t+2], vertices)){
+            cerr << "ERR: polyganizeraborted";
+            return false;
+        }
+    vertproc(vertices);
+
+    return true;
+}
@@ -0,0 +1,744 @@
+#include "PolygonizerParallel.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <stdlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+#define RES     10 /* # converge iterations, as polygonizer.cpp */
+#define RAND()    ((rand()&32767)/32767.)  /* random number, 0--1 */
+#define BIT(i, bit) (((i)>>(bit))&1)
+#define FLIP(i,bit) ((i)^1<<(bit)) /* flip the given bit of i */
+
+/* in polygonizer.cpp */
+void converge ( const R3Pt &in_p1, const R3Pt &p2, double v1, double v2,
+                double (*function)(const R3Pt &in_pt, void *fdata),
+                double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+                void *fdata, double tolerance, R3Pt &p);
+
+/* the six faces: neighbor offset, bit of the corner index flipped across the face, its four corners */
+static const int FACE_OFFSET[6][3] = {{-1,0,0},{1,0,0},{0,-1,0},{0,1,0},{0,0,-1},{0,0,1}};
+static const int FACE_BIT[6] = {2, 2, 1, 1, 0, 0};
+static const int FACE_CORNERS[6][4] = {{0,1,2,3},{4,5,6,7},{0,1,4,5},{2,3,6,7},{0,2,4,6},{1,3,5,7}};
+
+/* the 12 edges of a cube, corner n1 to corner n1 | bit, along axis 2 - log2(bit) */
+static const int CUBE_EDGES[12][3] = {
+    {0,4,0},{1,5,0},{2,6,0},{3,7,0},
+    {0,2,1},{1,3,1},{4,6,1},{5,7,1},
+    {0,1,2},{2,3,2},{4,5,2},{6,7,2}
+};
+
+/* the six tetrahedra of polygonize(), corners a, b, c, d */
+static const int CUBE_TETS[6][4] = {{0,2,4,1},{6,2,1,4},{6,2,3,1},{6,4,1,5},{6,1,3,5},{6,3,7,5}};
+/* the edges e1..e6 of a tetrahedron: ab, ac, ad, bc, bd, cd */
+static const int TET_EDGES[6][2] = {{0,1},{0,2},{0,3},{1,2},{1,3},{2,3}};
+/* dotet(): triangles, as edge numbers 1..6, for the 16 sign cases 8a+4b+2c+d, 0 terminated */
+static const int TET_TRIANGLES[16][7] = {
+    {0},
+    {5,6,3, 0},
+    {2,6,4, 0},
+    {3,5,4, 3,4,2, 0},
+    {1,4,5, 0},
+    {3,1,4, 3,4,6, 0},
+    {1,2,6, 1,6,5, 0},
+    {1,2,3, 0},
+    {1,3,2, 0},
+    {1,5,6, 1,6,2, 0},
+    {1,3,6, 1,6,4, 0},
+    {1,5,4, 0},
+    {3,2,4, 3,4,5, 0},
+    {6,2,4, 0},
+    {5,3,6, 0},
+    {0}
+};
+
+
+ParallelPolygonizer::ParallelPolygonizer(FUNCTION function, void *fdata, GRADFUNCTION gradfunction,
+                                         double size, int bounds, double tolerance, const R3Pt &start):
+    function(function),gradfunction(gradfunction),fdata(fdata),size(size),delta(size/(double)(RES*RES)),tolerance(tolerance),
+    bounds(bounds),start(start),pending(0),n_eval(0){}
+
+void ParallelPolygonizer::SetPoint(R3Pt &out_pt, int i, int j, int k) const{
+
+    out_pt[0] = start[0]+((double)i-0.5) * size;
+    out_pt[1] = start[1]+((double)j-0.5) * size;
+    out_pt[2] = start[2]+((double)k-0.5) * size;
+}
+
+double ParallelPolygonizer::Corner(int i, int j, int k){
+
+    long long key = Key(i, j, k);
+    CornerShard &sh = corners[Shard(key)];
+    {
+        lock_guard<mutex> lock(sh.m);
+        const double *v = sh.mp.Find(key);
+        if(v)return *v;
+    }
+    /* evaluated outside the lock: two threads may both evaluate a new corner, with the same result */
+    R3Pt pt;
+    SetPoint(pt, i, j, k);
+    double value = function(pt, fdata);
+    n_eval++;
+    lock_guard<mutex> lock(sh.m);
+    return *sh.mp.Insert(key, value).first;
+}
+
+bool ParallelPolygonizer::SetCenter(int i, int j, int k){
+
+    long long key = Key(i, j, k);
+    CenterShard &sh = centers[Shard(key)];
+    lock_guard<mutex> lock(sh.m);
+    return !sh.st.Insert(key, 1).second;
+}
+
+void ParallelPolygonizer::Push(int tid, const Cube &c){
+
+    pending++;
+    lock_guard<mutex> lock(queues[tid]->m);
+    queues[tid]->Push_Back(c);
+}
+
+/* own deque from the back (depth first, as the stack of polygonize), other deques from the front */
+bool ParallelPolygonizer::Pop(int tid, Cube &c){
+
+    int nq = queues.size();
+    for(int t=0;t<nq;++t){
+        WorkQueue &wq = *queues[(tid+t)%nq];
+        lock_guard<mutex> lock(wq.m);
+        if(t==0 ? wq.Pop_Back(c) : wq.Pop_Front(c))return true;
+    }
+    return false;
+}
+
+void ParallelPolygonizer::WorkQueue::Push_Back(const Cube &c){
+
+    if(count==buf.size()){
+        /* unrolled into a buffer twice as large, head at 0 */
+        vector<Cube> nb(max(size_t(64), buf.size()*2));
+        for(size_t t=0;t<count;++t)nb[t] = buf[(head+t)&(buf.size()-1)];
+        buf.swap(nb);
+        head = 0;
+        ++n_allocations;
+    }
+    buf[(head+count)&(buf.size()-1)] = c;
+    ++count;
+}
+
+bool ParallelPolygonizer::WorkQueue::Pop_Back(Cube &c){
+
+    if(!count)return false;
+    --count;
+    c = buf[(head+count)&(buf.size()-1)];
+    return true;
+}
+
+bool ParallelPolygonizer::WorkQueue::Pop_Front(Cube &c){
+
+    if(!count)return false;
+    c = buf[head];
+    head = (head+1)&(buf.size()-1);
+    --count;
+    return true;
+}
+
+/* the corners not handed over by the neighbor that pushed c are NaN */
+void ParallelPolygonizer::Process(int tid, Cube &c, CubeArena &visited){
+
+    for(int n=0;n<8;++n)
+        if(std::isnan(c.value[n]))c.value[n] = Corner(c.i+BIT(n,2), c.j+BIT(n,1), c.k+BIT(n,0));
+    visited.Push(c);
+
+    for(int f=0;f<6;++f){
+        const int *fc = FACE_CORNERS[f];
+        bool pos = c.value[fc[0]] > 0.0;
+        if((c.value[fc[1]] > 0.0) == pos && (c.value[fc[2]] > 0.0) == pos && (c.value[fc[3]] > 0.0) == pos)continue;
+
+        Cube nc;
+        nc.i = c.i + FACE_OFFSET[f][0];
+        nc.j = c.j + FACE_OFFSET[f][1];
+        nc.k = c.k + FACE_OFFSET[f][2];
+        if(abs(nc.i) > bounds || abs(nc.j) > bounds || abs(nc.k) > bounds)continue;
+        if(SetCenter(nc.i, nc.j, nc.k))continue;
+
+        for(int n=0;n<8;++n)nc.value[n] = numeric_limits<double>::quiet_NaN();
+        for(int t=0;t<4;++t)nc.value[FLIP(fc[t], FACE_BIT[f])] = c.value[fc[t]];
+        Push(tid, nc);
+    }
+}
+
+void ParallelPolygonizer::Propagate(const vector<Cube> &seeds){
+
+    int nthread = 1;
+#ifdef _OPENMP
+    nthread = omp_get_max_threads();
+#endif
+    queues.resize(nthread);
+    for(auto &wq:queues)wq = new WorkQueue;
+
+    pending = 0;
+    for(size_t s=0;s<seeds.size();++s){
+        if(SetCenter(seeds[s].i, seeds[s].j, seeds[s].k))continue;
+        pending++;
+        queues[s%nthread]->Push_Back(seeds[s]);
+    }
+
+    vector<CubeArena> visited(nthread);
+#pragma omp parallel num_threads(nthread)
+    {
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+        Cube c;
+        while(true){
+            if(Pop(tid, c)){
+                Process(tid, c, visited[tid]);
+                pending--;
+            }else if(pending==0)break;
+            else std::this_thread::yield();
+        }
+    }
+
+    for(auto &wq:queues){
+        n_allocations += wq->n_allocations;
+        delete wq;
+    }
+    queues.clear();
+    size_t nvisited = cubes.size();
+    for(auto &v:visited)nvisited += v.count;
+    if(nvisited > cubes.capacity()){
+        cubes.reserve(max(nvisited, cubes.capacity()*2));
+        ++n_allocations;
+    }
+    for(auto &v:visited){
+        n_allocations += v.chunks.size();
+        for(auto &ch:v.chunks)cubes.insert(cubes.end(), ch.begin(), ch.end());
+        v.chunks.clear();
+    }
+    n_evaluations = n_eval;
+}
+
+
+void ParallelPolygonizer::Band(const double *pts, int npt){
+
+    /* one thread inserts, into the shards of the propagation: centers for the visited cubes, corners
+     * for the values */
+    auto Visit = [&](int i, int j, int k){
+        long long key = Key(i, j, k);
+        return centers[Shard(key)].st.Insert(key, 1).second;
+    };
+    auto Value = [&](long long key){ return *corners[Shard(key)].mp.Find(key); };
+    vector<Cube> level;
+    for(int t=0;t<npt;++t){
+        Cube c;
+        Cube_Of(pts+t*3, c.i, c.j, c.k);
+        if(abs(c.i) > bounds || abs(c.j) > bounds || abs(c.k) > bounds)continue;
+        if(Visit(c.i, c.j, c.k))level.push_back(c);
+    }
+
+    long long n_band = 0;
+    vector<long long> keys;
+    vector<R3Pt> points;
+    vector<double> batch;
+    while(!level.empty()){
+        n_band += level.size();
+
+        /* the corners of the level not evaluated yet */
+        keys.clear();
+        points.clear();
+        for(const Cube &c:level)for(int n=0;n<8;++n){
+            int i = c.i+BIT(n,2), j = c.j+BIT(n,1), k = c.k+BIT(n,0);
+            long long key = Key(i, j, k);
+            if(!corners[Shard(key)].mp.Insert(key, 0.0).second)continue;
+            keys.push_back(key);
+            points.push_back(R3Pt());
+            SetPoint(points.back(), i, j, k);
+        }
+        const long long nk = keys.size();
+        batch.resize(nk);
+#pragma omp parallel for schedule(dynamic,64)
+        for(long long t=0;t<nk;++t)batch[t] = function(points[t], fdata);
+        for(long long t=0;t<nk;++t)*corners[Shard(keys[t])].mp.Find(keys[t]) = batch[t];
+        n_eval += nk;
+
+        vector<Cube> next;
+        for(Cube &c:level){
+            for(int n=0;n<8;++n)c.value[n] = Value(Key(c.i+BIT(n,2), c.j+BIT(n,1), c.k+BIT(n,0)));
+            bool crossed = false;
+            for(int f=0;f<6;++f){
+                const int *fc = FACE_CORNERS[f];
+                bool pos = c.value[fc[0]] > 0.0;
+                if((c.value[fc[1]] > 0.0) == pos && (c.value[fc[2]] > 0.0) == pos && (c.value[fc[3]] > 0.0) == pos)continue;
+                crossed = true;
+
+                Cube nc;
+                nc.i = c.i + FACE_OFFSET[f][0];
+                nc.j = c.j + FACE_OFFSET[f][1];
+                nc.k = c.k + FACE_OFFSET[f][2];
+                if(abs(nc.i) > bounds || abs(nc.j) > bounds || abs(nc.k) > bounds)continue;
+                if(Visit(nc.i, nc.j, nc.k))next.push_back(nc);
+            }
+            if(crossed)cubes.push_back(c);
+        }
+        level.swap(next);
+    }
+    n_evaluations = n_eval;
+    long long ncorner, ncenter;
+    Entries(ncorner, ncenter);
+    printf("narrow band: %lld cubes, %d crossed, %lld corners\n", n_band, (int)cubes.size(), ncorner);
+}
+
+
+void ParallelPolygonizer::Cube_Of(const double *p, int &i, int &j, int &k) const{
+
+    i = (int)floor((p[0]-start[0])/size + 0.5);
+    j = (int)floor((p[1]-start[1])/size + 0.5);
+    k = (int)floor((p[2]-start[2])/size + 0.5);
+}
+
+void ParallelPolygonizer::Seeds(const double *pts, int npt, int reach, vector<Cube> &seeds) const{
+
+    KeyTable<char> st;
+    seeds.clear();
+    for(int t=0;t<npt;++t){
+        int ci, cj, ck;
+        Cube_Of(pts+t*3, ci, cj, ck);
+        for(int di=-reach;di<=reach;++di)for(int dj=-reach;dj<=reach;++dj)for(int dk=-reach;dk<=reach;++dk){
+            Cube c;
+            c.i = ci+di; c.j = cj+dj; c.k = ck+dk;
+            if(abs(c.i) > bounds || abs(c.j) > bounds || abs(c.k) > bounds)continue;
+            if(!st.Insert(Key(c.i, c.j, c.k), 1).second)continue;
+            for(int n=0;n<8;++n)c.value[n] = numeric_limits<double>::quiet_NaN();
+            seeds.push_back(c);
+        }
+    }
+}
+
+void ParallelPolygonizer::Index_Crossed(double offthres){
+
+    const double h = offthres + size;
+    if(h!=crossedcell){
+        crossed.Clear();
+        crossedijk.clear();
+        crossednext.clear();
+        n_crossed = 0;
+        crossedcell = h;
+    }
+    for(;n_crossed<cubes.size();++n_crossed){
+        const Cube &c = cubes[n_crossed];
+        bool pos = c.value[0] > 0.0;
+        for(int n=1;n<8;++n)if((c.value[n] > 0.0) != pos){
+            /* cube center at start + (i,j,k) * size */
+            const int id = crossednext.size();
+            int *last = crossed.Insert(Key((int)floor(c.i*size/h), (int)floor(c.j*size/h), (int)floor(c.k*size/h)), -1).first;
+            crossednext.push_back(*last);
+            *last = id;
+            crossedijk.push_back(c.i);
+            crossedijk.push_back(c.j);
+            crossedijk.push_back(c.k);
+            break;
+        }
+    }
+}
+
+bool ParallelPolygonizer::Covered(const double *p, double offthres) const{
+
+    const double h = crossedcell;
+    int ci = (int)floor((p[0]-start[0])/h), cj = (int)floor((p[1]-start[1])/h), ck = (int)floor((p[2]-start[2])/h);
+    for(int di=-1;di<=1;++di)for(int dj=-1;dj<=1;++dj)for(int dk=-1;dk<=1;++dk){
+        const int *last = crossed.Find(Key(ci+di, cj+dj, ck+dk));
+        if(!last)continue;
+        for(int b=*last;b>=0;b=crossednext[b]){
+            /* distance from p to the cube */
+            double d2 = 0;
+            for(int k=0;k<3;++k){
+                double d = max(0.0, fabs(p[k] - (start[k] + crossedijk[b*3+k]*size)) - 0.5*size);
+                d2 += d*d;
+            }
+            if(d2 <= offthres*offthres)return true;
+        }
+    }
+    return false;
+}
+
+
+void ParallelPolygonizer::Fronts(const double *pts, int npt, double offthres){
+
+    /* fronts per round, from points spread over the ones left */
+    const int NFRONT = 8;
+    Index_Crossed(offthres);
+    vector<double> left, next, from;
+    for(int t=0;t<npt;++t)if(!Covered(pts+t*3, offthres))left.insert(left.end(), pts+t*3, pts+t*3+3);
+
+    vector<Cube> seeds;
+    for(int round=1;!left.empty();++round){
+        const int nleft = left.size()/3, nseed = min(nleft, NFRONT);
+        vector<char> isseed(nleft, 0);
+        from.clear();
+        for(int s=0;s<nseed;++s){
+            int t = (long long)s*nleft/nseed;
+            isseed[t] = 1;
+            from.insert(from.end(), left.begin()+t*3, left.begin()+t*3+3);
+        }
+        Seeds(from.data(), nseed, 1, seeds);
+        Propagate(seeds);
+        Index_Crossed(offthres);
+
+        /* a seed point still not covered is off the surface */
+        int ndrop = 0;
+        next.clear();
+        for(int t=0;t<nleft;++t){
+            if(Covered(left.data()+t*3, offthres))continue;
+            if(isseed[t])++ndrop;
+            else next.insert(next.end(), left.begin()+t*3, left.begin()+t*3+3);
+        }
+        left.swap(next);
+        printf("front %d: %d seeds, %d cubes, %d points not covered, %d off the surface\n", round, nseed, (int)cubes.size(), (int)left.size()/3, ndrop);
+    }
+}
+
+void ParallelPolygonizer::Refine(const ParallelPolygonizer &coarse, int ratio){
+
+    const long long mask = (1LL<<21)-1;
+    for(int s=0;s<NSHARD;++s)coarse.corners[s].mp.For_Each([&](long long ckey, double value){
+        int i = (int)((ckey>>42) & mask) - (1<<20), j = (int)((ckey>>21) & mask) - (1<<20), k = (int)(ckey & mask) - (1<<20);
+        long long key = Key(i*ratio, j*ratio, k*ratio);
+        corners[Shard(key)].mp.Insert(key, value);
+    });
+
+    /* crossed edges of the coarse cubes, as the lattice point and the axis */
+    vector<pair<long long,int>> edges;
+    for(const Cube &c:coarse.cubes)for(int e=0;e<12;++e){
+        int n1 = CUBE_EDGES[e][0], n2 = CUBE_EDGES[e][1];
+        if((c.value[n1] > 0.0) == (c.value[n2] > 0.0))continue;
+        edges.push_back(make_pair(Key(c.i+BIT(n1,2), c.j+BIT(n1,1), c.k+BIT(n1,0)), CUBE_EDGES[e][2]));
+    }
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+    /* the crossed piece of each one on this lattice, from its inner corners */
+    const long long nedge = edges.size();
+    vector<long long> seedkeys(nedge);
+#pragma omp parallel for schedule(dynamic,64)
+    for(long long e=0;e<nedge;++e){
+        long long key = edges[e].first;
+        int c[3] = {(int)((key>>42) & mask) - (1<<20), (int)((key>>21) & mask) - (1<<20), (int)(key & mask) - (1<<20)};
+        for(int t=0;t<3;++t)c[t] *= ratio;
+        double v = Corner(c[0], c[1], c[2]);
+        for(int t=1;t<=ratio;++t){
+            int d[3] = {c[0], c[1], c[2]};
+            d[edges[e].second] += 1;
+            double w = Corner(d[0], d[1], d[2]);
+            if((v > 0.0) != (w > 0.0))break;
+            for(int k=0;k<3;++k)c[k] = d[k];
+            v = w;
+        }
+        seedkeys[e] = Key(c[0], c[1], c[2]);
+    }
+    sort(seedkeys.begin(), seedkeys.end());
+    seedkeys.erase(unique(seedkeys.begin(), seedkeys.end()), seedkeys.end());
+
+    vector<Cube> seeds;
+    for(long long key:seedkeys){
+        Cube c;
+        c.i = (int)((key>>42) & mask) - (1<<20);
+        c.j = (int)((key>>21) & mask) - (1<<20);
+        c.k = (int)(key & mask) - (1<<20);
+        if(abs(c.i) > bounds || abs(c.j) > bounds || abs(c.k) > bounds)continue;
+        for(int n=0;n<8;++n)c.value[n] = numeric_limits<double>::quiet_NaN();
+        seeds.push_back(c);
+    }
+    printf("refine x%d: %d crossed edges reused\n", ratio, (int)nedge);
+    Propagate(seeds);
+}
+
+
+long long ParallelPolygonizer::Allocations() const{
+
+    long long re = n_allocations + crossed.n_allocations;
+    for(int s=0;s<NSHARD;++s)re += corners[s].mp.n_allocations + centers[s].st.n_allocations;
+    return re;
+}
+
+void ParallelPolygonizer::Entries(long long &ncorner, long long &ncenter) const{
+
+    ncorner = ncenter = 0;
+    for(int s=0;s<NSHARD;++s){
+        ncorner += corners[s].mp.count;
+        ncenter += centers[s].st.count;
+    }
+}
+
+
+void ParallelPolygonizer::Normal(const R3Pt &in_point, R3Vec &out_vec) const{
+
+    if(gradfunction){
+        gradfunction(in_point, fdata, out_vec);
+    }else{
+        const double f = function(in_point, fdata);
+        R3Vec vec(0,0,0);
+        for(int i=0;i<3;++i){
+            vec[i] = delta;
+            out_vec[i] = function(in_point + vec, fdata) - f;
+            vec[i] = 0.0;
+        }
+    }
+    out_vec = UnitSafe( out_vec );
+}
+
+namespace{
+
+struct EdgeRec{
+    long long k1, k2;               // corner keys, k1 < k2
+    int c1[3], c2[3];
+    double v1, v2;
+    bool operator<(const EdgeRec &e)const{ return k1<e.k1 || (k1==e.k1 && k2<e.k2); }
+    bool operator==(const EdgeRec &e)const{ return k1==e.k1 && k2==e.k2; }
+};
+
+inline void Make_Edge(const ParallelPolygonizer::Cube &c, int n1, int n2, EdgeRec &e){
+
+    int a[3] = {c.i+BIT(n1,2), c.j+BIT(n1,1), c.k+BIT(n1,0)};
+    int b[3] = {c.i+BIT(n2,2), c.j+BIT(n2,1), c.k+BIT(n2,0)};
+    long long ka = ParallelPolygonizer::Key(a[0],a[1],a[2]), kb = ParallelPolygonizer::Key(b[0],b[1],b[2]);
+    if(ka>kb){
+        swap(ka, kb);
+        swap(n1, n2);
+        for(int t=0;t<3;++t)swap(a[t], b[t]);
+    }
+    e.k1 = ka; e.k2 = kb;
+    for(int t=0;t<3;++t){
+        e.c1[t] = a[t];
+        e.c2[t] = b[t];
+    }
+    e.v1 = c.value[n1];
+    e.v2 = c.value[n2];
+}
+
+}
+
+void ParallelPolygonizer::Triangulate(vector<VERTEX> &vertices, vector<int> &triangles){
+
+    sort(cubes.begin(), cubes.end(), [](const Cube &a, const Cube &b){ return Key(a.i,a.j,a.k) < Key(b.i,b.j,b.k); });
+    const long long ncube = cubes.size();
+
+    /* crossing edges of all tetrahedra, sorted and unique: the vertex id is the rank of the edge */
+    int nthread = 1;
+#ifdef _OPENMP
+    nthread = omp_get_max_threads();
+#endif
+    vector<vector<EdgeRec>> thread_edges(nthread);
+    vector<int> ntri(ncube+1, 0);
+#pragma omp parallel num_threads(nthread)
+    {
+        int tid = 0;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+#endif
+#pragma omp for schedule(static)
+        for(long long ci=0;ci<ncube;++ci){
+            const Cube &c = cubes[ci];
+            for(int t=0;t<6;++t){
+                const int *tet = CUBE_TETS[t];
+                int index = 0;
+                for(int v=0;v<4;++v)if(c.value[tet[v]] > 0.0)index += 8>>v;
+                int m = 0;
+                while(TET_TRIANGLES[index][m])++m;
+                ntri[ci+1] += m/3;
+                for(int e=0;e<6;++e){
+                    int n1 = tet[TET_EDGES[e][0]], n2 = tet[TET_EDGES[e][1]];
+                    if((c.value[n1] > 0.0) == (c.value[n2] > 0.0))continue;
+                    EdgeRec er;
+                    Make_Edge(c, n1, n2, er);
+                    thread_edges[tid].push_back(er);
+                }
+            }
+        }
+    }
+    vector<EdgeRec> edges;
+    for(auto &te:thread_edges){
+        edges.insert(edges.end(), te.begin(), te.end());
+        vector<EdgeRec>().swap(te);
+    }
+    sort(edges.begin(), edges.end());
+    edges.erase(unique(edges.begin(), edges.end()), edges.end());
+
+    const long long nedge = edges.size();
+    vertices.resize(nedge);
+#pragma omp parallel for schedule(dynamic,64)
+    for(long long e=0;e<nedge;++e){
+        R3Pt a, b;
+        SetPoint(a, edges[e].c1[0], edges[e].c1[1], edges[e].c1[2]);
+        SetPoint(b, edges[e].c2[0], edges[e].c2[1], edges[e].c2[2]);
+        converge(a, b, edges[e].v1, edges[e].v2, function, gradfunction, fdata, tolerance, vertices[e].position);
+        Normal(vertices[e].position, vertices[e].normal);
+    }
+
+    for(long long ci=0;ci<ncube;++ci)ntri[ci+1] += ntri[ci];
+    triangles.resize(ntri[ncube]*3);
+#pragma omp parallel for schedule(static)
+    for(long long ci=0;ci<ncube;++ci){
+        const Cube &c = cubes[ci];
+        int *out = triangles.data() + ntri[ci]*3;
+        for(int t=0;t<6;++t){
+            const int *tet = CUBE_TETS[t];
+            int index = 0, vid[6];
+            for(int v=0;v<4;++v)if(c.value[tet[v]] > 0.0)index += 8>>v;
+            for(int e=0;e<6;++e){
+                int n1 = tet[TET_EDGES[e][0]], n2 = tet[TET_EDGES[e][1]];
+                if((c.value[n1] > 0.0) == (c.value[n2] > 0.0))continue;
+                EdgeRec er;
+                Make_Edge(c, n1, n2, er);
+                vid[e] = lower_bound(edges.begin(), edges.end(), er) - edges.begin();
+            }
+            for(const int *tr = TET_TRIANGLES[index]; *tr; ++tr)*out++ = vid[*tr-1];
+        }
+    }
+}
+
+
+bool ParallelPolygonizer::Output(int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+                                 void (*vertproc)(VERTICES vertices))
+{
+    vector<VERTEX> vs;
+    vector<int> tris;
+    Triangulate(vs, tris);
+    long long ncorner, ncenter;
+    Entries(ncorner, ncenter);
+    printf("polygonizer tables: %lld corners, %lld cube centers, %lld allocations (a node per entry: %lld)\n",
+           ncorner, ncenter, Allocations(), ncorner+ncenter);
+
+    VERTICES vertices;
+    vertices.count = vertices.max = vs.size();
+    vertices.ptr = vs.data();
+    for(size_t t=0;t<tris.size();t+=3)
+        if(!triproc(tris[t], tris[t+1], tris[t+2], vertices)){
+            cerr << "ERR: polyganizeraborted";
+            return false;
+        }
+    vertproc(vertices);
+
+    return true;
+}
+
+
+/* polygonize_parallel: same arguments and result as polygonize, see polygonizer.cpp */
+
+bool polygonize_parallel (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double tolerance,
+    const R3Pt &in_pt,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices))
+{
+    /* find point on surface, beginning search at in_pt, with the random sequence of find() */
+    R3Pt in_p, out_p, start;
+    double in_value = 0, out_value = 0;
+    bool in_ok = false, out_ok = false;
+    srand(1);
+    for(int sign=1;sign>=0;--sign){
+        double range = size;
+        for(int i=0;i<10000;++i){
+            const R3Vec vec(range*(RAND()-0.5), range*(RAND()-0.5), range*(RAND()-0.5));
+            R3Pt test = in_pt + vec;
+            double value = function(test, fdata);
+            if(sign == (value > 0.0)){
+                if(sign){ in_p = test; in_value = value; in_ok = true; }
+                else{ out_p = test; out_value = value; out_ok = true; }
+                break;
+            }
+            range = range*1.0005;
+        }
+    }
+    if(!in_ok || !out_ok){
+        if(!in_ok)printf("in not ok\n");
+        if(!out_ok)printf("out not ok\n");
+        cerr << "ERR: polyganizer can't find starting point\n";
+        return false;
+    }
+    if(tolerance > 0.0)tolerance *= size;
+    else tolerance = 0.0;
+    converge(in_p, out_p, in_value, out_value, function, gradfunction, fdata, tolerance, start);
+
+    ParallelPolygonizer pp(function, fdata, gradfunction, size, bounds, tolerance, start);
+    vector<ParallelPolygonizer::Cube> seeds(1);
+    seeds[0].i = seeds[0].j = seeds[0].k = 0;
+    for(int n=0;n<8;++n)seeds[0].value[n] = numeric_limits<double>::quiet_NaN();
+    pp.Propagate(seeds);
+
+    return pp.Output(triproc, vertproc);
+}
+
+
+/* polygonize_components: polygonize every component of the surface passing near the points pts (npt,
+ * xyz) in one pass, on the lattice of cubes of size centered at in_pt; fronts are started from a few of
+ * the points farther than offthres from the crossed cubes, until every point is covered or off the
+ * surface; the fronts share the corners and the visited cubes, so no region is evaluated twice and the
+ * mesh has no duplicate */
+
+bool polygonize_components (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double tolerance,
+    const R3Pt &in_pt,
+    const double *pts,
+    int npt,
+    double offthres,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices))
+{
+    if(tolerance > 0.0)tolerance *= size;
+    else tolerance = 0.0;
+
+    ParallelPolygonizer pp(function, fdata, gradfunction, size, bounds, tolerance, in_pt);
+    pp.Fronts(pts, npt, offthres);
+    if(pp.cubes.empty()){
+        cerr << "ERR: polyganizer no input point is near the surface\n";
+        return false;
+    }
+
+    return pp.Output(triproc, vertproc);
+}
+
+
+/* polygonize_band: polygonize the surface through the points pts (npt, xyz) on the narrow band of cubes
+ * around them, see ParallelPolygonizer::Band; the lattice is fixed at in_pt, every component of the
+ * surface that passes near a point is found, no starting point is searched */
+
+bool polygonize_band (
+    double (*function)(const R3Pt &in_pt, void *fdata),
+    void *fdata,
+    double (*gradfunction)(const R3Pt &in_pt, void *fdata, R3Vec &out_grad),
+    double size,
+    int bounds,
+    double tolerance,
+    const R3Pt &in_pt,
+    const double *pts,
+    int npt,
+    int (*triproc)(int i1, int i2, int i3, VERTICES vertices),
+    void (*vertproc)(VERTICES vertices))
+{
+    if(tolerance > 0.0)tolerance *= size;
+    else tolerance = 0.0;
+
+    ParallelPolygonizer pp(function, fdata, gradfunction, size, bounds, tolerance, in_pt);
+    pp.Band(pts, npt);
+    if(pp.cubes.empty()){
+        cerr << "ERR: polyganizer no cube of the band is crossed by the surface\n";
+        return false;
+    }
+
+    return pp.Output(triproc, vertproc);
+}
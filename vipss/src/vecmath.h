@@ -0,0 +1,65 @@
+#ifndef VECMATH_H
+#define VECMATH_H
+
+#include <math.h>
+
+/* branch-free sin/cos of a strided array, written so that the loop vectorizes
+ * the argument is reduced to [-pi/4, pi/4] with a three-part pi/2 and the cephes minimax
+ * polynomials are used on the reduced argument, accurate to ~1 ulp for |t| < 1e5 */
+
+namespace VecMath {
+
+/* round to nearest through the 1.5*2^52 trick, exact for |y| < 2^51
+ * libm floor/rint only vectorize with SSE4.1 and -fno-trapping-math, this one does on plain SSE2
+ * (it relies on the build not using -ffast-math) */
+inline double Round(double y){
+    const double MAGIC = 6755399441055744.0;
+    return (y + MAGIC) - MAGIC;
+}
+
+inline void SinCos(const double *t, int stride, int n, double *s, double *c){
+
+    const double TWO_OVER_PI = 6.36619772367581382433E-1;
+    const double DP1 = 1.57079625129699707031E0;
+    const double DP2 = 7.54978941586159635335E-8;
+    const double DP3 = 5.39030285815811905290E-15;
+
+#pragma omp simd
+    for(int i=0;i<n;++i){
+        double x = t[i*stride];
+        double q = Round(x * TWO_OVER_PI);
+        double z = ((x - q*DP1) - q*DP2) - q*DP3;
+        double zz = z*z;
+
+        double ps = 1.58962301576546568060E-10;
+        ps = ps*zz - 2.50507477628578072866E-8;
+        ps = ps*zz + 2.75573136213857245213E-6;
+        ps = ps*zz - 1.98412698295895385996E-4;
+        ps = ps*zz + 8.33333333332211858878E-3;
+        ps = ps*zz - 1.66666666666666307295E-1;
+        ps = z + z*zz*ps;
+
+        double pc = -1.13585365213876817300E-11;
+        pc = pc*zz + 2.08757008419747316778E-9;
+        pc = pc*zz - 2.75573141792967388112E-7;
+        pc = pc*zz + 2.48015872888517045348E-5;
+        pc = pc*zz - 1.38888888888730564116E-3;
+        pc = pc*zz + 4.16666666666665929218E-2;
+        pc = 1.0 - 0.5*zz + zz*zz*pc;
+
+        /* quadrant q mod 4: swap the two polynomials on odd ones, flip the signs on the half turns
+         * o = q - 2 round(q/2) is 0 on even q, +-1 on odd; q - 4 round(q/4) is 0 or 1 on the quadrants 0 and 1
+         * only plain selects on double compares here, int masks would keep the loop scalar without SSE4.1 */
+        double o = q - 2.0*Round(q*0.5);
+        double ms = q - 4.0*Round(q*0.25) - 0.5;
+        double mc = q + 1.0 - 4.0*Round((q+1.0)*0.25) - 0.5;
+        double ss = o*o > 0.5 ? pc : ps;
+        double cc = o*o > 0.5 ? ps : pc;
+        s[i] = ms*ms > 1.0 ? -ss : ss;
+        c[i] = mc*mc > 1.0 ? -cc : cc;
+    }
+}
+
+}
+
+#endif // VECMATH_H